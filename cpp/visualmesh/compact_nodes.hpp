@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_COMPACT_NODES_HPP
+#define VISUALMESH_COMPACT_NODES_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "node.hpp"
+#include "utility/math.hpp"
+
+namespace visualmesh {
+
+namespace detail {
+
+    /**
+     * @brief Decode a unit vector from two 16 bit octahedral coordinates packed into 32 bits
+     *
+     * @details
+     *  The unit sphere is projected onto the octahedron |x| + |y| + |z| = 1, and the lower half of the octahedron is
+     *  folded out over the corners of the upper half so that the whole sphere maps onto the square [-1, 1]^2, which is
+     *  then stored with 16 bits per axis.
+     */
+    template <typename Scalar>
+    inline vec3<Scalar> decode_octahedral(const uint32_t& code) {
+        const Scalar x = Scalar(code & 0xFFFF) * Scalar(2.0 / 65535.0) - Scalar(1);
+        const Scalar y = Scalar(code >> 16) * Scalar(2.0 / 65535.0) - Scalar(1);
+        const Scalar z = Scalar(1) - std::abs(x) - std::abs(y);
+
+        // Unfold the lower half of the octahedron
+        const Scalar t = std::max(-z, Scalar(0));
+        return normalise(vec3<Scalar>{x >= 0 ? x - t : x + t, y >= 0 ? y - t : y + t, z});
+    }
+
+    /**
+     * @brief Encode a unit vector as two 16 bit octahedral coordinates packed into 32 bits
+     *
+     * @details
+     *  Rather than rounding each coordinate to the nearest value, the four values around the exact coordinates are all
+     *  tried and the one that decodes closest to the vector is used, which roughly halves the worst case error.
+     */
+    template <typename Scalar>
+    inline uint32_t encode_octahedral(const vec3<Scalar>& v) {
+        const double l1 = std::abs(double(v[0])) + std::abs(double(v[1])) + std::abs(double(v[2]));
+        double x        = v[0] / l1;
+        double y        = v[1] / l1;
+
+        // Fold the lower half of the octahedron out over the corners of the upper half
+        if (v[2] < 0) {
+            const double fx = (1.0 - std::abs(y)) * (x >= 0 ? 1.0 : -1.0);
+            const double fy = (1.0 - std::abs(x)) * (y >= 0 ? 1.0 : -1.0);
+            x               = fx;
+            y               = fy;
+        }
+
+        const vec3<double> target = {{double(v[0]), double(v[1]), double(v[2])}};
+        const double u            = (x + 1.0) * (65535.0 / 2.0);
+        const double w            = (y + 1.0) * (65535.0 / 2.0);
+        uint32_t best             = 0;
+        double best_dot           = -2.0;
+        for (const double& cu : {std::floor(u), std::ceil(u)}) {
+            for (const double& cw : {std::floor(w), std::ceil(w)}) {
+                const uint32_t code = uint32_t(std::min(std::max(cu, 0.0), 65535.0))
+                                      | uint32_t(std::min(std::max(cw, 0.0), 65535.0)) << 16;
+                const double d      = dot(decode_octahedral<double>(code), target);
+                if (d > best_dot) {
+                    best     = code;
+                    best_dot = d;
+                }
+            }
+        }
+        return best;
+    }
+
+}  // namespace detail
+
+/**
+ * @brief The nodes of a mesh stored in a compact form that is decoded as it is accessed
+ *
+ * @details
+ *  Each ray is stored in 32 bits using an octahedral encoding which is accurate to around 4e-5 radians. Each neighbour
+ *  is stored in 16 bits as its offset from the index of the node, as the nodes of a mesh are ordered so that most
+ *  neighbours are close by. The neighbours that are too far away to fit are looked up in a table instead, as is the
+ *  off screen node one past the end of the nodes. For a float Ring6 mesh this takes each node from 36 bytes to about
+ *  16 and for a double mesh with eight neighbours from 56 bytes to about 20.
+ *
+ * @tparam Scalar       the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam N_NEIGHBOURS the number of neighbours that each point has
+ */
+template <typename Scalar, int N_NEIGHBOURS>
+class CompactNodes {
+public:
+    CompactNodes() = default;
+
+    /**
+     * @brief Encode a list of nodes
+     *
+     * @param nodes the nodes to encode, with the off screen node one past the end
+     */
+    explicit CompactNodes(const std::vector<Node<Scalar, N_NEIGHBOURS>>& nodes)
+      : rays(nodes.size()), offsets(nodes.size() * N_NEIGHBOURS) {
+        const int n = nodes.size();
+        for (int i = 0; i < n; ++i) {
+            rays[i] = detail::encode_octahedral(nodes[i].ray);
+
+            // Keep track of the largest error, finding the angle from the chord as it is accurate for small angles
+            const Scalar chord = norm(subtract(ray(i), nodes[i].ray));
+            const Scalar angle = Scalar(2) * std::asin(std::min(Scalar(1), chord * Scalar(0.5)));
+            max_error          = std::max(max_error, angle);
+
+            for (int j = 0; j < N_NEIGHBOURS; ++j) {
+                const int slot = i * N_NEIGHBOURS + j;
+                const int d    = nodes[i].neighbours[j] - i;
+                if (nodes[i].neighbours[j] == n) { offsets[slot] = OFF_SCREEN; }
+                else if (ESCAPE < d && d <= std::numeric_limits<int16_t>::max()) {
+                    offsets[slot] = d;
+                }
+                else {
+                    offsets[slot] = ESCAPE;
+                    escapes.emplace_back(slot, nodes[i].neighbours[j]);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Convert compact nodes of a different Scalar to this Scalar type
+     *
+     * @details
+     *  The encoded rays and neighbours do not depend on the Scalar type so they are copied as they are, rather than
+     *  being decoded and encoded again which could move each ray by up to twice the error.
+     *
+     * @tparam U the Scalar type of the other compact nodes
+     *
+     * @param b the other compact nodes to convert from
+     */
+    template <typename U>
+    explicit CompactNodes(const CompactNodes<U, N_NEIGHBOURS>& b)
+      : rays(b.rays), offsets(b.offsets), escapes(b.escapes), max_error(static_cast<Scalar>(b.max_error)) {}
+
+    /// The number of nodes
+    std::size_t size() const {
+        return rays.size();
+    }
+
+    /// If there are no nodes
+    bool empty() const {
+        return rays.empty();
+    }
+
+    /// Decode the unit vector for a node
+    vec3<Scalar> ray(const int& i) const {
+        return detail::decode_octahedral<Scalar>(rays[i]);
+    }
+
+    /// Decode the absolute indices of the neighbours of a node
+    std::array<int, N_NEIGHBOURS> neighbours(const int& i) const {
+        std::array<int, N_NEIGHBOURS> out;
+        const int16_t* o = &offsets[i * N_NEIGHBOURS];
+        for (int j = 0; j < N_NEIGHBOURS; ++j) {
+            out[j] = o[j] == OFF_SCREEN ? int(rays.size()) : o[j] == ESCAPE ? escaped(i * N_NEIGHBOURS + j) : i + o[j];
+        }
+        return out;
+    }
+
+    /// Decode a node
+    Node<Scalar, N_NEIGHBOURS> operator[](const int& i) const {
+        return Node<Scalar, N_NEIGHBOURS>{ray(i), neighbours(i)};
+    }
+
+    /// The largest angle in radians between any of the rays and the ray it was encoded from
+    Scalar error() const {
+        return max_error;
+    }
+
+    /// The number of bytes used to store the nodes
+    std::size_t bytes() const {
+        return rays.size() * sizeof(uint32_t) + offsets.size() * sizeof(int16_t)
+               + escapes.size() * sizeof(std::pair<int, int>);
+    }
+
+private:
+    /// The offset used for a neighbour that is the off screen node
+    static constexpr int16_t OFF_SCREEN = std::numeric_limits<int16_t>::min();
+    /// The offset used for a neighbour that is too far away and is stored in the escape table
+    static constexpr int16_t ESCAPE = OFF_SCREEN + 1;
+
+    /// Look up a neighbour that was too far away to store as an offset
+    int escaped(const int& slot) const {
+        return std::lower_bound(escapes.begin(),
+                                escapes.end(),
+                                slot,
+                                [](const std::pair<int, int>& e, const int& s) { return e.first < s; })
+          ->second;
+    }
+
+    /// The octahedral encoding of the ray for each node
+    std::vector<uint32_t> rays;
+    /// The offset from each node to each of its neighbours, or one of the special values
+    std::vector<int16_t> offsets;
+    /// The slot (node * N_NEIGHBOURS + neighbour) and absolute index of each escaped neighbour, sorted by slot
+    std::vector<std::pair<int, int>> escapes;
+    /// The largest error in any of the encoded rays
+    Scalar max_error = 0;
+
+    template <typename S, int N>
+    friend class CompactNodes;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_COMPACT_NODES_HPP
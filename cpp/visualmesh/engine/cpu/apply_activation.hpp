@@ -20,6 +20,8 @@
 
 #include <algorithm>
 #include <cmath>
+#include <iterator>
+#include <numeric>
 #include <vector>
 
 #include "visualmesh/network_structure.hpp"
@@ -30,49 +32,67 @@ namespace engine {
 
         namespace activation {
 
-            template <typename Scalar>
-            void selu(std::vector<Scalar>& data, const int& /*dimensions*/) {
-                std::transform(data.begin(), data.end(), data.begin(), [](const Scalar& s) {
+            template <typename Iterator>
+            void selu(Iterator begin, Iterator end, const int& /*dimensions*/) {
+                using Scalar = typename std::iterator_traits<Iterator>::value_type;
+                std::transform(begin, end, begin, [](const Scalar& s) {
                     constexpr const Scalar lambda = 1.0507009873554804934193349852946;
                     constexpr const Scalar alpha  = 1.6732632423543772848170429916717;
                     return lambda * (s >= 0 ? s : alpha * std::exp(s) - alpha);
                 });
             }
 
-            template <typename Scalar>
-            void relu(std::vector<Scalar>& data, const int& /*dimensions*/) {
-                std::transform(
-                  data.begin(), data.end(), data.begin(), [](const Scalar& s) { return std::max(s, Scalar(0.0)); });
+            template <typename Iterator>
+            void relu(Iterator begin, Iterator end, const int& /*dimensions*/) {
+                using Scalar = typename std::iterator_traits<Iterator>::value_type;
+                std::transform(begin, end, begin, [](const Scalar& s) { return std::max(s, Scalar(0.0)); });
             }
 
-            template <typename Scalar>
-            void tanh(std::vector<Scalar>& data, const int& /*dimensions*/) {
-                std::transform(data.begin(), data.end(), data.begin(), [](const Scalar& s) {  //
+            template <typename Iterator>
+            void tanh(Iterator begin, Iterator end, const int& /*dimensions*/) {
+                using Scalar = typename std::iterator_traits<Iterator>::value_type;
+                std::transform(begin, end, begin, [](const Scalar& s) {  //
                     return std::tanh(s);
                 });
             }
 
-            template <typename Scalar>
-            void softmax(std::vector<Scalar>& data, const int& dimensions) {
-                std::transform(data.begin(), data.end(), data.begin(), [](const Scalar& s) { return std::exp(s); });
-                for (auto it = data.begin(); it < data.end(); std::advance(it, dimensions)) {
-                    const auto end = std::next(it, dimensions);
-                    Scalar total   = std::accumulate(it, end, Scalar(0.0));
-                    std::transform(it, end, it, [total](const Scalar& s) { return s / total; });
+            template <typename Iterator>
+            void softmax(Iterator begin, Iterator end, const int& dimensions) {
+                using Scalar = typename std::iterator_traits<Iterator>::value_type;
+                std::transform(begin, end, begin, [](const Scalar& s) { return std::exp(s); });
+                for (auto it = begin; it < end; std::advance(it, dimensions)) {
+                    const auto row_end = std::next(it, dimensions);
+                    Scalar total       = std::accumulate(it, row_end, Scalar(0.0));
+                    std::transform(it, row_end, it, [total](const Scalar& s) { return s / total; });
                 }
             }
         }  // namespace activation
 
-        template <typename Scalar>
-        void apply_activation(const ActivationFunction& fn, std::vector<Scalar>& data, const int& dimensions) {
+        /**
+         * @brief Apply an activation function to a range of values made up of whole rows of `dimensions` values
+         *
+         * @tparam Iterator a random access iterator over the values to apply the activation function to
+         *
+         * @param fn          the activation function to apply
+         * @param begin       the start of the range of values
+         * @param end         one past the end of the range of values
+         * @param dimensions  the number of values in each row (used by activations that work on a row like softmax)
+         */
+        template <typename Iterator>
+        void apply_activation(const ActivationFunction& fn, Iterator begin, Iterator end, const int& dimensions) {
             switch (fn) {
-                case ActivationFunction::SELU: activation::selu(data, dimensions); break;
-                case ActivationFunction::RELU: activation::relu(data, dimensions); break;
-                case ActivationFunction::TANH: activation::tanh(data, dimensions); break;
-                case ActivationFunction::SOFTMAX: activation::softmax(data, dimensions); break;
+                case ActivationFunction::SELU: activation::selu(begin, end, dimensions); break;
+                case ActivationFunction::RELU: activation::relu(begin, end, dimensions); break;
+                case ActivationFunction::TANH: activation::tanh(begin, end, dimensions); break;
+                case ActivationFunction::SOFTMAX: activation::softmax(begin, end, dimensions); break;
             }
         }
 
+        template <typename Scalar>
+        void apply_activation(const ActivationFunction& fn, std::vector<Scalar>& data, const int& dimensions) {
+            apply_activation(fn, data.begin(), data.end(), dimensions);
+        }
+
     }  // namespace cpu
 }  // namespace engine
 }  // namespace visualmesh
@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_CPU_DENSE_HPP
+#define VISUALMESH_ENGINE_CPU_DENSE_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include "simd.hpp"
+#include "visualmesh/network_structure.hpp"
+
+namespace visualmesh {
+namespace engine {
+    namespace cpu {
+
+        /**
+         * @brief A network layer with its weights packed into a single contiguous panel for the dense kernel
+         *
+         * @details
+         *  The weights are stored row major as [input][output] with each row padded out to a multiple of the SIMD
+         *  width. This lets the kernel load a full vector of outputs for one input at a time without any bounds checks.
+         *  The biases are padded with zeros in the same way.
+         *
+         * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+         */
+        template <typename Scalar>
+        struct PackedLayer {
+            /// The number of input dimensions to the layer
+            int inputs;
+            /// The number of output dimensions of the layer
+            int outputs;
+            /// The distance between the start of each row of weights, a multiple of the SIMD width
+            int stride;
+            /// The weights stored as [input][stride]
+            PackedWeights<Scalar> weights;
+            /// The biases padded out to the stride
+            std::vector<Scalar> biases;
+            /// The activation function to apply after the layer
+            ActivationFunction activation;
+        };
+
+        /**
+         * @brief Pack a network layer into the layout used by the dense kernel
+         *
+         * @details
+         *  Packed weights from the layer are used as is when their stride is a multiple of the SIMD width, which is
+         *  always the case for weights that were packed from a vector of vectors. Otherwise they are repacked.
+         *
+         * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+         *
+         * @param layer the layer to pack
+         *
+         * @return the packed version of the layer
+         */
+        template <typename Scalar>
+        PackedLayer<Scalar> pack(const Layer<Scalar>& layer) {
+            constexpr int W = simd::Vector<Scalar>::width;
+
+            PackedLayer<Scalar> packed;
+            packed.weights    = layer.packed();
+            packed.activation = layer.activation;
+
+            if (packed.weights.stride() % W != 0) {
+                Weights<Scalar> weights(packed.weights.rows(), std::vector<Scalar>(packed.weights.cols()));
+                for (std::size_t i = 0; i < weights.size(); ++i) {
+                    std::copy(packed.weights.row(i), packed.weights.row(i) + packed.weights.cols(), weights[i].begin());
+                }
+                packed.weights = PackedWeights<Scalar>(weights);
+            }
+
+            packed.inputs  = packed.weights.rows();
+            packed.outputs = layer.biases.size();
+            packed.stride  = packed.weights.stride();
+            if (int(packed.weights.cols()) != packed.outputs) {
+                throw std::runtime_error("The number of weights and biases in a layer do not match");
+            }
+
+            packed.biases.resize(packed.stride, Scalar(0));
+            std::copy(layer.biases.begin(), layer.biases.end(), packed.biases.begin());
+
+            return packed;
+        }
+
+        namespace detail {
+
+            /**
+             * @brief Apply a packed layer to a block of points whose inputs are split over several rows in memory
+             *
+             * @details
+             *  The input for each point is the concatenation of Segments rows of `width` values. Each vector of outputs
+             *  is held in a register for all the points in the block while the inputs are accumulated into it, so every
+             *  weight vector that is loaded is used Block times. The accumulation is done in input order for every
+             *  output so the value for a point does not depend on the block it is in or where its rows are stored.
+             *
+             * @tparam Block    the number of points to process at once
+             * @tparam Segments the number of rows that make up the input for each point
+             * @tparam Scalar   the scalar type used for calculations and storage (normally one of float or double)
+             *
+             * @param rows    the rows of input for each point in the block
+             * @param width   the number of values in each row, Segments * width must equal layer.inputs
+             * @param layer   the packed layer to apply
+             * @param output  where to write the outputs for the first point, each point has layer.outputs values
+             */
+            template <int Block, int Segments, typename Scalar>
+            inline void dense_block(const Scalar* const (&rows)[Block][Segments],
+                                    const int& width,
+                                    const PackedLayer<Scalar>& layer,
+                                    Scalar* output) {
+                using V          = simd::Vector<Scalar>;
+                constexpr int W  = V::width;
+                const int n_out  = layer.outputs;
+                const Scalar* wp = layer.weights.data();
+
+                for (int o = 0; o < n_out; o += W) {
+                    typename V::type acc[Block];
+                    for (int b = 0; b < Block; ++b) {
+                        acc[b] = V::load(&layer.biases[o]);
+                    }
+                    for (int s = 0; s < Segments; ++s) {
+                        const Scalar* ws = wp + s * width * layer.stride + o;
+                        for (int i = 0; i < width; ++i) {
+                            const typename V::type w = V::load(ws + i * layer.stride);
+                            for (int b = 0; b < Block; ++b) {
+                                acc[b] = V::fma(V::broadcast(rows[b][s][i]), w, acc[b]);
+                            }
+                        }
+                    }
+
+                    // The output rows are packed without padding so the last vector may need to be cut short
+                    if (o + W <= n_out) {
+                        for (int b = 0; b < Block; ++b) {
+                            V::store(output + b * n_out + o, acc[b]);
+                        }
+                    }
+                    else {
+                        Scalar tail[W];
+                        for (int b = 0; b < Block; ++b) {
+                            V::store(tail, acc[b]);
+                            std::copy(tail, tail + (n_out - o), output + b * n_out + o);
+                        }
+                    }
+                }
+            }
+
+            /**
+             * @brief Apply a packed layer to a block of points reading each point and its neighbours from the input
+             *
+             * @tparam Block        the number of points to process at once
+             * @tparam N_NEIGHBOURS the number of neighbours each point has
+             * @tparam Scalar       the scalar type used for calculations and storage (normally one of float or double)
+             *
+             * @param input          the input values stored as [point][dimensions]
+             * @param dimensions     the number of input values for each point
+             * @param neighbourhood  the neighbours of each point
+             * @param point          the index of the first point in the block
+             * @param layer          the packed layer to apply
+             * @param output         where to write the outputs for the first point in the block
+             */
+            template <int Block, std::size_t N_NEIGHBOURS, typename Scalar>
+            inline void gather_dense_block(const Scalar* input,
+                                           const int& dimensions,
+                                           const std::vector<std::array<int, N_NEIGHBOURS>>& neighbourhood,
+                                           const int& point,
+                                           const PackedLayer<Scalar>& layer,
+                                           Scalar* output) {
+                const Scalar* rows[Block][N_NEIGHBOURS + 1];
+                for (int b = 0; b < Block; ++b) {
+                    rows[b][0] = input + (point + b) * dimensions;
+                    for (unsigned int n = 0; n < N_NEIGHBOURS; ++n) {
+                        rows[b][n + 1] = input + neighbourhood[point + b][n] * dimensions;
+                    }
+                }
+                dense_block<Block, N_NEIGHBOURS + 1>(rows, dimensions, layer, output);
+            }
+
+        }  // namespace detail
+
+        /**
+         * @brief Apply the weights and biases of a packed layer to a range of points
+         *
+         * @details
+         *  Points are processed in blocks so each weight vector is reused across several points while it is in a
+         *  register. The activation function is not applied.
+         *
+         * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+         *
+         * @param input     the input values stored as [point][layer.inputs]
+         * @param layer     the packed layer to apply
+         * @param output    the output values stored as [point][layer.outputs]
+         * @param n_points  the number of points to process
+         */
+        template <typename Scalar>
+        void dense(const Scalar* input, const PackedLayer<Scalar>& layer, Scalar* output, const int& n_points) {
+            constexpr int Block = 4;
+
+            int p = 0;
+            for (; p + Block <= n_points; p += Block) {
+                const Scalar* rows[Block][1];
+                for (int b = 0; b < Block; ++b) {
+                    rows[b][0] = input + (p + b) * layer.inputs;
+                }
+                detail::dense_block<Block, 1>(rows, layer.inputs, layer, output + p * layer.outputs);
+            }
+            for (; p < n_points; ++p) {
+                const Scalar* rows[1][1] = {{input + p * layer.inputs}};
+                detail::dense_block<1, 1>(rows, layer.inputs, layer, output + p * layer.outputs);
+            }
+        }
+
+        /**
+         * @brief Apply the first layer of a convolutional group to a range of points, gathering neighbours as it goes
+         *
+         * @details
+         *  This gives the same result as gathering each point and its neighbours into a single row of
+         *  (N_NEIGHBOURS + 1) * dimensions values and then calling dense on that, however it reads the neighbours
+         *  directly from the input using the neighbourhood so the gathered copy never needs to be made. The activation
+         *  function is not applied.
+         *
+         * @tparam N_NEIGHBOURS the number of neighbours each point has
+         * @tparam Scalar       the scalar type used for calculations and storage (normally one of float or double)
+         *
+         * @param input          the input values stored as [point][dimensions] for every point in the neighbourhood
+         * @param dimensions     the number of input values for each point
+         * @param neighbourhood  the neighbours of each point
+         * @param start          the index of the first point to process
+         * @param end            one past the index of the last point to process
+         * @param layer          the packed layer to apply, which must have (N_NEIGHBOURS + 1) * dimensions inputs
+         * @param output         the output values stored as [point][layer.outputs] starting from the start point
+         */
+        template <std::size_t N_NEIGHBOURS, typename Scalar>
+        void gather_dense(const Scalar* input,
+                          const int& dimensions,
+                          const std::vector<std::array<int, N_NEIGHBOURS>>& neighbourhood,
+                          const int& start,
+                          const int& end,
+                          const PackedLayer<Scalar>& layer,
+                          Scalar* output) {
+            constexpr int Block = 4;
+
+            int p = start;
+            for (; p + Block <= end; p += Block) {
+                detail::gather_dense_block<Block>(
+                  input, dimensions, neighbourhood, p, layer, output + (p - start) * layer.outputs);
+            }
+            for (; p < end; ++p) {
+                detail::gather_dense_block<1>(
+                  input, dimensions, neighbourhood, p, layer, output + (p - start) * layer.outputs);
+            }
+        }
+
+    }  // namespace cpu
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CPU_DENSE_HPP
@@ -18,15 +18,26 @@
 #ifndef VISUALMESH_ENGINE_CPU_ENGINE_HPP
 #define VISUALMESH_ENGINE_CPU_ENGINE_HPP
 
+#include <algorithm>
 #include <cstdint>
+#include <memory>
 #include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "apply_activation.hpp"
+#include "dense.hpp"
 #include "visualmesh/classified_mesh.hpp"
 #include "visualmesh/mesh.hpp"
 #include "visualmesh/network_structure.hpp"
+#include "visualmesh/prepared_lens.hpp"
 #include "visualmesh/projected_mesh.hpp"
 #include "visualmesh/utility/fourcc.hpp"
+#include "visualmesh/utility/id_cache.hpp"
+#include "visualmesh/utility/projection.hpp"
+#include "visualmesh/utility/reverse_index.hpp"
+#include "visualmesh/utility/thread_pool.hpp"
 #include "visualmesh/visualmesh.hpp"
 
 namespace visualmesh {
@@ -38,9 +49,11 @@ namespace engine {
          *
          * @details
          *  The CPU implementation is designed to be a simple implementation of the visual mesh projection and
-         *  classification code. It is only single threaded and is not designed to be used in high performance contexts.
-         *  For those use another implementation that is able to take advantage of other system features such as GPUs or
-         *  multithreading.
+         *  classification code. By default it is single threaded, however it can be given a concurrency in which case
+         *  each stage of a frame (projection, image interpolation and each network layer) is split by point
+         *  ranges over a persistent thread pool. Every point is calculated in exactly the same way regardless of which
+         *  thread it is on, so the results are bit identical to the single threaded path. For high performance contexts
+         *  prefer another implementation that is able to take advantage of other system features such as GPUs.
          *
          * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
          */
@@ -50,20 +63,17 @@ namespace engine {
             /**
              * @brief Construct a new CPU Engine object
              *
-             * @param structure the network structure to use classification
+             * @param structure   the network structure to use classification
+             * @param concurrency the number of threads to use when processing a single frame (including the calling
+             *                    thread). A value of 1 processes everything on the calling thread.
              */
-            Engine(const NetworkStructure<Scalar>& structure = {}) : structure(structure) {
-                // Transpose all the weights matrices to make it easier for us to multiply against
-                for (auto& conv : this->structure) {
-                    for (auto& layer : conv) {
-                        auto& w = layer.weights;
-                        Weights<Scalar> new_weights(w.front().size(), std::vector<Scalar>(w.size()));
-                        for (unsigned int i = 0; i < w.size(); ++i) {
-                            for (unsigned int j = 0; j < w[i].size(); ++j) {
-                                new_weights[j][i] = w[i][j];
-                            }
-                        }
-                        w = std::move(new_weights);
+            Engine(const NetworkStructure<Scalar>& structure = {}, const unsigned int& concurrency = 1)
+              : pool(std::make_shared<util::ThreadPool>(concurrency)) {
+                // Pack all the weights matrices into contiguous panels for the dense kernel
+                for (const auto& conv : structure) {
+                    network.emplace_back();
+                    for (const auto& layer : conv) {
+                        network.back().emplace_back(pack(layer));
                     }
                 }
             }
@@ -85,58 +95,116 @@ namespace engine {
                                                                           const Lens<Scalar>& lens) const {
                 static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
 
-                // Lookup the on screen ranges
-                auto ranges = mesh.lookup(Hoc, lens);
+                // Lookup the on screen points, reusing what we found for this mesh last time and keeping the pixel
+                // coordinates of the points the lookup had to project
+                prepared_lens.update(lens);
+                auto segments = mesh.lookup(Hoc, prepared_lens, lookup_cache[mesh.id()], lookup_pixels);
 
                 // Convenience variables
-                const auto& nodes = mesh.nodes;
                 const mat3<Scalar> Rco(block<3, 3>(transpose(Hoc)));
 
-                // Work out how many points total there are in the ranges
+                // Work out how many points total there are in the segments
                 unsigned int n_points = 0;
-                for (auto& r : ranges) {
-                    n_points += r.second - r.first;
+                for (const auto& s : segments) {
+                    n_points += s.range.second - s.range.first;
                 }
 
                 // Output variables
                 std::vector<int> global_indices;
                 global_indices.reserve(n_points);
-                std::vector<vec2<Scalar>> pixels;
-                pixels.reserve(n_points);
-
-                // Loop through adding global indices and pixel coordinates
-                for (const auto& range : ranges) {
-                    for (int i = range.first; i < range.second; ++i) {
-                        // Even though we have already gone through a bsp to remove out of range points, sometimes it's
-                        // not perfect and misses by a few pixels. So as we are projecting the points here we also need
-                        // to check that they are on screen
-                        auto px = project(multiply(Rco, nodes[i].ray), lens);
-                        if (0 <= px[0] && px[0] + 1 < lens.dimensions[0] && 0 <= px[1]
-                            && px[1] + 1 < lens.dimensions[1]) {
-                            global_indices.emplace_back(i);
-                            pixels.emplace_back(px);
+                std::vector<vec2<Scalar>> pixels(n_points);
+                std::vector<bool> projected(n_points, false);
+
+                // Flatten the segments so the projection can be split up between threads, taking any pixel coordinates
+                // that the lookup already calculated
+                for (const auto& s : segments) {
+                    if (s.pixels >= 0) {
+                        const int n = s.range.second - s.range.first;
+                        std::copy(lookup_pixels.begin() + s.pixels,
+                                  lookup_pixels.begin() + s.pixels + n,
+                                  pixels.begin() + global_indices.size());
+                        std::fill(projected.begin() + global_indices.size(),
+                                  projected.begin() + global_indices.size() + n,
+                                  true);
+                    }
+                    for (int i = s.range.first; i < s.range.second; ++i) {
+                        global_indices.emplace_back(i);
+                    }
+                }
+
+                // Project each of the remaining points marking any that end up off the screen
+                camera_rays.resize(n_points * 3);
+                Scalar* x = camera_rays.data();
+                Scalar* y = x + n_points;
+                Scalar* z = y + n_points;
+                pool->parallel_for(0, n_points, 0, [&](const int& start, const int& end) {
+                    // Rotate the rays into the camera so they can be projected all at once
+                    for (int i = start; i < end; ++i) {
+                        if (!projected[i]) {
+                            const vec3<Scalar> ray = multiply(Rco, mesh.ray(global_indices[i]));
+                            x[i]                   = ray[0];
+                            y[i]                   = ray[1];
+                            z[i]                   = ray[2];
+                        }
+                    }
+                    // Project each run of points that the lookup did not already project, the point after a run
+                    // has always been projected so it can be skipped
+                    for (int i = start; i < end; ++i) {
+                        if (!projected[i]) {
+                            int j = i + 1;
+                            while (j < end && !projected[j]) {
+                                ++j;
+                            }
+                            project(x + i, y + i, z + i, j - i, prepared_lens, pixels.data() + i);
+                            i = j;
                         }
                     }
+
+                    // Even though we have already gone through a bsp to remove out of range points, sometimes it's not
+                    // perfect and misses by a few pixels. So as we are projecting the points here we also need to check
+                    // that they are on screen
+                    for (int i = start; i < end; ++i) {
+                        const auto& px = pixels[i];
+                        if (!(0 <= px[0] && px[0] + 1 < lens.dimensions[0] && 0 <= px[1]
+                              && px[1] + 1 < lens.dimensions[1])) {
+                            global_indices[i] = -1;
+                        }
+                    }
+                });
+
+                // Remove the points that were off the screen keeping the rest in order
+                unsigned int on_screen = 0;
+                for (unsigned int i = 0; i < n_points; ++i) {
+                    if (global_indices[i] >= 0) {
+                        global_indices[on_screen] = global_indices[i];
+                        pixels[on_screen]         = pixels[i];
+                        ++on_screen;
+                    }
                 }
+                global_indices.resize(on_screen);
+                pixels.resize(on_screen);
 
                 // Update the number of points to account for how many pixels we removed
                 n_points = pixels.size();
 
-                // Build our reverse lookup, the default point goes to the null point
-                std::vector<int> r_lookup(nodes.size() + 1, n_points);
-                for (unsigned int i = 0; i < n_points; ++i) {
-                    r_lookup[global_indices[i]] = i;
-                }
+                // Build our reverse lookup, any point that is not on screen goes to the null point
+                reverse_index.reset(mesh.size() + 1);
+                pool->parallel_for(0, n_points, 0, [&](const int& start, const int& end) {
+                    for (int i = start; i < end; ++i) {
+                        reverse_index.set(global_indices[i], i);
+                    }
+                });
 
                 // Build our local neighbourhood map
                 std::vector<std::array<int, N_NEIGHBOURS>> neighbourhood(n_points + 1);  // +1 for the null point
-                for (unsigned int i = 0; i < n_points; ++i) {
-                    const Node<Scalar, N_NEIGHBOURS>& node = nodes[global_indices[i]];
-                    for (unsigned int j = 0; j < node.neighbours.size(); ++j) {
-                        const auto& n       = node.neighbours[j];
-                        neighbourhood[i][j] = r_lookup[n];
+                pool->parallel_for(0, n_points, 0, [&](const int& start, const int& end) {
+                    for (int i = start; i < end; ++i) {
+                        const auto neighbours = mesh.neighbours(global_indices[i]);
+                        for (unsigned int j = 0; j < neighbours.size(); ++j) {
+                            neighbourhood[i][j] = reverse_index.get(neighbours[j], n_points);
+                        }
                     }
-                }
+                });
                 // Last point is the null point
                 neighbourhood[n_points].fill(n_points);
 
@@ -159,7 +227,8 @@ namespace engine {
             inline ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
                                                                                  const mat4<Scalar>& Hoc,
                                                                                  const Lens<Scalar>& lens) const {
-                return operator()(mesh.height(Hoc[2][3]), Hoc, lens);
+                const auto m = mesh.get(Hoc[2][3]);
+                return operator()(*m, Hoc, lens);
             }
 
             /**
@@ -191,7 +260,7 @@ namespace engine {
                 if (projected.global_indices.empty()) { return ClassifiedMesh<Scalar, N_NEIGHBOURS>(); }
 
                 // Based on the fourcc code, load the data from the image into input
-                input.reserve(n_points * 4);
+                input.resize(n_points * 4);
                 const int R     = ('R' == (format & 0xFF) ? 0 : 2);
                 const int B     = ('R' == (format & 0xFF) ? 2 : 0);
                 const int depth = ('A' == ((format >> 24) & 0xFF) ? 4 : 3);
@@ -207,72 +276,90 @@ namespace engine {
                                                  + fourcc_text(format));
                 }
 
-                for (const auto& px : projected.pixel_coordinates) {
-                    const uint8_t* const im = reinterpret_cast<const uint8_t*>(image);
+                const uint8_t* const im = reinterpret_cast<const uint8_t*>(image);
+                const auto& pixels      = projected.pixel_coordinates;
+                pool->parallel_for(0, int(pixels.size()), 0, [&](const int& start, const int& end) {
+                    for (int i = start; i < end; ++i) {
+                        const vec4<Scalar> p = interpolate(pixels[i], im, lens.dimensions, depth);
 
-                    const vec4<Scalar> p = interpolate(px, im, lens.dimensions, depth);
-
-                    input.emplace_back(p[R]);
-                    input.emplace_back(p[1]);
-                    input.emplace_back(p[B]);
-                    input.emplace_back(p[3]);
-                }
+                        input[i * 4 + 0] = p[R];
+                        input[i * 4 + 1] = p[1];
+                        input[i * 4 + 2] = p[B];
+                        input[i * 4 + 3] = p[3];
+                    }
+                });
 
                 // Four -1 values for the offscreen point
-                input.insert(input.end(), {Scalar(-1.0), Scalar(-1.0), Scalar(-1.0), Scalar(-1.0)});
+                std::fill(std::prev(input.end(), 4), input.end(), Scalar(-1.0));
 
                 // We start out with 4d input (RGBAesque)
                 unsigned int input_dimensions  = 4;
                 unsigned int output_dimensions = 0;
 
                 // For each convolutional layer
-                for (unsigned int conv_no = 0; conv_no < structure.size(); ++conv_no) {
-                    const auto& conv = structure[conv_no];
-
-                    // Ensure enough space for the convolutional gather
-                    output.resize(0);
-                    output.reserve(input.size() * (N_NEIGHBOURS + 1));
-                    output_dimensions = input_dimensions * (N_NEIGHBOURS + 1);
-
-                    // Gather over each of the neighbours
-                    for (unsigned int i = 0; i < neighbourhood.size(); ++i) {
-                        output.insert(output.end(),
-                                      std::next(input.begin(), i * input_dimensions),
-                                      std::next(input.begin(), (i + 1) * input_dimensions));
-                        for (const auto& n : neighbourhood[i]) {
-                            output.insert(output.end(),
-                                          std::next(input.begin(), n * input_dimensions),
-                                          std::next(input.begin(), (n + 1) * input_dimensions));
-                        }
+                for (unsigned int conv_no = 0; conv_no < network.size(); ++conv_no) {
+                    const auto& conv = network[conv_no];
+
+                    // A group without any layers just gathers each point with its neighbours
+                    if (conv.empty()) {
+                        output_dimensions = input_dimensions * (N_NEIGHBOURS + 1);
+                        output.resize(n_points * output_dimensions);
+
+                        pool->parallel_for(0, n_points, 0, [&](const int& start, const int& end) {
+                            for (int i = start; i < end; ++i) {
+                                auto out = std::copy(std::next(input.begin(), i * input_dimensions),
+                                                     std::next(input.begin(), (i + 1) * input_dimensions),
+                                                     std::next(output.begin(), i * output_dimensions));
+                                for (const auto& n : neighbourhood[i]) {
+                                    out = std::copy(std::next(input.begin(), n * input_dimensions),
+                                                    std::next(input.begin(), (n + 1) * input_dimensions),
+                                                    out);
+                                }
+                            }
+                        });
+
+                        std::swap(input, output);
+                        input_dimensions = output_dimensions;
+                        continue;
                     }
 
-                    // Output becomes input
-                    std::swap(input, output);
-                    input_dimensions = output_dimensions;
+                    if (conv.front().inputs != int(input_dimensions * (N_NEIGHBOURS + 1))) {
+                        throw std::runtime_error("The first layer of convolution " + std::to_string(conv_no)
+                                                 + " does not take the gathered neighbourhood as input");
+                    }
 
                     // For each network layer
                     for (unsigned int layer_no = 0; layer_no < conv.size(); ++layer_no) {
-                        const auto& weights    = conv[layer_no].weights;
-                        const auto& biases     = conv[layer_no].biases;
-                        const auto& activation = conv[layer_no].activation;
+                        const auto& layer = conv[layer_no];
 
                         // Setup the shapes
-                        output_dimensions = biases.size();
-                        output.resize(0);
-                        output.reserve(n_points * output_dimensions);
-
-                        // Apply the weights and bias
-                        auto in_point = input.begin();
-                        for (unsigned int i = 0; i < n_points; ++i) {
-                            for (unsigned int j = 0; j < output_dimensions; ++j) {
-                                output.emplace_back(std::inner_product(
-                                  in_point, in_point + input_dimensions, weights[j].begin(), biases[j]));
+                        output_dimensions = layer.outputs;
+                        output.resize(n_points * output_dimensions);
+
+                        pool->parallel_for(0, n_points, 0, [&](const int& start, const int& end) {
+                            // Apply the weights and bias, the first layer reads the neighbours directly from the input
+                            if (layer_no == 0) {
+                                gather_dense(input.data(),
+                                             input_dimensions,
+                                             neighbourhood,
+                                             start,
+                                             end,
+                                             layer,
+                                             output.data() + start * output_dimensions);
+                            }
+                            else {
+                                dense(input.data() + start * input_dimensions,
+                                      layer,
+                                      output.data() + start * output_dimensions,
+                                      end - start);
                             }
-                            in_point += input_dimensions;
-                        }
 
-                        // Apply the activation function
-                        apply_activation(activation, output, output_dimensions);
+                            // Apply the activation function
+                            apply_activation(layer.activation,
+                                             std::next(output.begin(), start * output_dimensions),
+                                             std::next(output.begin(), end * output_dimensions),
+                                             output_dimensions);
+                        });
 
                         // Swap our values over
                         std::swap(input, output);
@@ -306,17 +393,43 @@ namespace engine {
                                                                            const Lens<Scalar>& lens,
                                                                            const void* image,
                                                                            const uint32_t& format) const {
-                return operator()(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+                const auto m = mesh.get(Hoc[2][3]);
+                return operator()(*m, Hoc, lens, image, format);
+            }
+
+            /// Drop everything that was kept from previous frames, releasing the memory it used
+            void clear_cache() {
+                lookup_cache.clear();
+                prepared_lens = PreparedLens<Scalar>();
+                std::vector<Scalar>().swap(input);
+                std::vector<Scalar>().swap(output);
+                std::vector<vec2<Scalar>>().swap(lookup_pixels);
+                std::vector<Scalar>().swap(camera_rays);
+                reverse_index = util::ReverseIndex();
             }
 
         private:
-            /// The network structure used to perform the operations
-            NetworkStructure<Scalar> structure;
+            /// The network structure used to perform the operations, with the weights packed for the dense kernel
+            std::vector<std::vector<PackedLayer<Scalar>>> network;
+
+            /// The thread pool used to split up the work for a single frame
+            std::shared_ptr<util::ThreadPool> pool;
 
             /// An input buffer used to ping/pong when doing classification so we don't have to remake them
             mutable std::vector<Scalar> input;
             /// An output buffer used to ping/pong when doing classification so we don't have to remake them
             mutable std::vector<Scalar> output;
+            /// A buffer for the pixel coordinates found by the lookup so we don't have to remake it
+            mutable std::vector<vec2<Scalar>> lookup_pixels;
+            /// A buffer for the x, y and z components of the rays in the camera so we don't have to remake it
+            mutable std::vector<Scalar> camera_rays;
+            /// The lens used for the previous frame so it only needs to be prepared again when it changes
+            mutable PreparedLens<Scalar> prepared_lens;
+            /// The results of the previous lookup so the next frame only needs to retest what changed, kept only for
+            /// the most recent mesh as it is about half the size of a compact mesh
+            mutable util::IdCache<LookupCache<Scalar>> lookup_cache{1};
+            /// Maps the index of each node to its index in the projected mesh, reused so it never needs clearing
+            mutable util::ReverseIndex reverse_index;
 
             vec4<Scalar> get_pixel(const vec2<Scalar>& px,
                                    const uint8_t* const image,
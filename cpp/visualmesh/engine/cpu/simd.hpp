@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_ENGINE_CPU_SIMD_HPP
+#define VISUALMESH_ENGINE_CPU_SIMD_HPP
+
+#if defined(__AVX512F__) || defined(__AVX2__) && defined(__FMA__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace visualmesh {
+namespace engine {
+    namespace cpu {
+        namespace simd {
+
+            /**
+             * @brief A thin wrapper over the widest SIMD vector the compiler is targeting for a scalar type
+             *
+             * @details
+             *  The instruction set is chosen at compile time from the architecture flags (e.g. -march=native) in the
+             *  order AVX-512, AVX2 + FMA, SSE2, then NEON. If none of these are available, or the scalar type has no
+             *  vector implementation, this falls back to a single scalar lane. Every lane performs the same sequence of
+             *  operations regardless of width so the results for each lane do not depend on how the work is blocked.
+             *
+             * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+             */
+            template <typename Scalar>
+            struct Vector {
+                using type                 = Scalar;
+                static constexpr int width = 1;
+
+                static inline type load(const Scalar* p) {
+                    return *p;
+                }
+                static inline void store(Scalar* p, const type& v) {
+                    *p = v;
+                }
+                static inline type broadcast(const Scalar& s) {
+                    return s;
+                }
+                /// Calculates a * b + c
+                static inline type fma(const type& a, const type& b, const type& c) {
+                    return a * b + c;
+                }
+            };
+
+#if defined(__AVX512F__)
+            template <>
+            struct Vector<float> {
+                using type                 = __m512;
+                static constexpr int width = 16;
+
+                static inline type load(const float* p) {
+                    return _mm512_loadu_ps(p);
+                }
+                static inline void store(float* p, const type& v) {
+                    _mm512_storeu_ps(p, v);
+                }
+                static inline type broadcast(const float& s) {
+                    return _mm512_set1_ps(s);
+                }
+                static inline type fma(const type& a, const type& b, const type& c) {
+                    return _mm512_fmadd_ps(a, b, c);
+                }
+            };
+
+            template <>
+            struct Vector<double> {
+                using type                 = __m512d;
+                static constexpr int width = 8;
+
+                static inline type load(const double* p) {
+                    return _mm512_loadu_pd(p);
+                }
+                static inline void store(double* p, const type& v) {
+                    _mm512_storeu_pd(p, v);
+                }
+                static inline type broadcast(const double& s) {
+                    return _mm512_set1_pd(s);
+                }
+                static inline type fma(const type& a, const type& b, const type& c) {
+                    return _mm512_fmadd_pd(a, b, c);
+                }
+            };
+#elif defined(__AVX2__) && defined(__FMA__)
+            template <>
+            struct Vector<float> {
+                using type                 = __m256;
+                static constexpr int width = 8;
+
+                static inline type load(const float* p) {
+                    return _mm256_loadu_ps(p);
+                }
+                static inline void store(float* p, const type& v) {
+                    _mm256_storeu_ps(p, v);
+                }
+                static inline type broadcast(const float& s) {
+                    return _mm256_set1_ps(s);
+                }
+                static inline type fma(const type& a, const type& b, const type& c) {
+                    return _mm256_fmadd_ps(a, b, c);
+                }
+            };
+
+            template <>
+            struct Vector<double> {
+                using type                 = __m256d;
+                static constexpr int width = 4;
+
+                static inline type load(const double* p) {
+                    return _mm256_loadu_pd(p);
+                }
+                static inline void store(double* p, const type& v) {
+                    _mm256_storeu_pd(p, v);
+                }
+                static inline type broadcast(const double& s) {
+                    return _mm256_set1_pd(s);
+                }
+                static inline type fma(const type& a, const type& b, const type& c) {
+                    return _mm256_fmadd_pd(a, b, c);
+                }
+            };
+#elif defined(__SSE2__)
+            // SSE2 has no fused multiply add so this multiplies and adds separately
+            template <>
+            struct Vector<float> {
+                using type                 = __m128;
+                static constexpr int width = 4;
+
+                static inline type load(const float* p) {
+                    return _mm_loadu_ps(p);
+                }
+                static inline void store(float* p, const type& v) {
+                    _mm_storeu_ps(p, v);
+                }
+                static inline type broadcast(const float& s) {
+                    return _mm_set1_ps(s);
+                }
+                static inline type fma(const type& a, const type& b, const type& c) {
+                    return _mm_add_ps(_mm_mul_ps(a, b), c);
+                }
+            };
+
+            template <>
+            struct Vector<double> {
+                using type                 = __m128d;
+                static constexpr int width = 2;
+
+                static inline type load(const double* p) {
+                    return _mm_loadu_pd(p);
+                }
+                static inline void store(double* p, const type& v) {
+                    _mm_storeu_pd(p, v);
+                }
+                static inline type broadcast(const double& s) {
+                    return _mm_set1_pd(s);
+                }
+                static inline type fma(const type& a, const type& b, const type& c) {
+                    return _mm_add_pd(_mm_mul_pd(a, b), c);
+                }
+            };
+#elif defined(__ARM_NEON)
+            template <>
+            struct Vector<float> {
+                using type                 = float32x4_t;
+                static constexpr int width = 4;
+
+                static inline type load(const float* p) {
+                    return vld1q_f32(p);
+                }
+                static inline void store(float* p, const type& v) {
+                    vst1q_f32(p, v);
+                }
+                static inline type broadcast(const float& s) {
+                    return vdupq_n_f32(s);
+                }
+                static inline type fma(const type& a, const type& b, const type& c) {
+#if defined(__aarch64__)
+                    return vfmaq_f32(c, a, b);
+#else
+                    return vmlaq_f32(c, a, b);
+#endif  // defined(__aarch64__)
+                }
+            };
+
+#if defined(__aarch64__)
+            template <>
+            struct Vector<double> {
+                using type                 = float64x2_t;
+                static constexpr int width = 2;
+
+                static inline type load(const double* p) {
+                    return vld1q_f64(p);
+                }
+                static inline void store(double* p, const type& v) {
+                    vst1q_f64(p, v);
+                }
+                static inline type broadcast(const double& s) {
+                    return vdupq_n_f64(s);
+                }
+                static inline type fma(const type& a, const type& b, const type& c) {
+                    return vfmaq_f64(c, a, b);
+                }
+            };
+#endif  // defined(__aarch64__)
+#endif
+
+        }  // namespace simd
+    }      // namespace cpu
+}  // namespace engine
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_ENGINE_CPU_SIMD_HPP
@@ -38,9 +38,12 @@
 #include "visualmesh/engine/opencl/operation/wrapper.hpp"
 #include "visualmesh/mesh.hpp"
 #include "visualmesh/network_structure.hpp"
+#include "visualmesh/prepared_lens.hpp"
 #include "visualmesh/projected_mesh.hpp"
+#include "visualmesh/utility/id_cache.hpp"
 #include "visualmesh/utility/math.hpp"
 #include "visualmesh/utility/projection.hpp"
+#include "visualmesh/utility/reverse_index.hpp"
 #include "visualmesh/visualmesh.hpp"
 
 namespace visualmesh {
@@ -216,7 +219,8 @@ namespace engine {
             inline ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
                                                                                  const mat4<Scalar>& Hoc,
                                                                                  const Lens<Scalar>& lens) const {
-                return operator()(mesh.height(Hoc[2][3]), Hoc, lens);
+                const auto m = mesh.get(Hoc[2][3]);
+                return operator()(*m, Hoc, lens);
             }
 
             /**
@@ -440,11 +444,13 @@ namespace engine {
                                                                            const Lens<Scalar>& lens,
                                                                            const void* image,
                                                                            const uint32_t& format) const {
-                return operator()(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+                const auto m = mesh.get(Hoc[2][3]);
+                return operator()(*m, Hoc, lens, image, format);
             }
 
             void clear_cache() {
                 device_points_cache.clear();
+                lookup_cache.clear();
                 indices_map_memory.memory         = nullptr;
                 indices_map_memory.n_points       = 0;
                 pixel_coordinates_memory.memory   = nullptr;
@@ -464,8 +470,9 @@ namespace engine {
               do_project(const Mesh<Scalar, Model>& mesh, const mat4<Scalar>& Hoc, const Lens<Scalar>& lens) const {
                 static constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
 
-                // Lookup the on screen ranges
-                auto ranges = mesh.lookup(Hoc, lens);
+                // Lookup the on screen ranges, reusing what we found for this mesh last time
+                prepared_lens.update(lens);
+                auto ranges = mesh.lookup(Hoc, prepared_lens, lookup_cache[mesh.id()]);
 
                 // Reused variables
                 cl_int error;
@@ -481,24 +488,20 @@ namespace engine {
                 }};
                 // clang-format on
 
-                // Convenience variables
-                const auto& nodes = mesh.nodes;
-
                 // Upload our visual mesh unit vectors if we have to
-                cl::mem cl_points;
-
-                auto device_mesh = device_points_cache.find(&mesh);
-                if (device_mesh == device_points_cache.end()) {
+                cl::mem cl_points = device_points_cache[mesh.id()];
+                if (cl_points == nullptr) {
                     cl_points =
                       cl::mem(::clCreateBuffer(
-                                context, CL_MEM_READ_ONLY, sizeof(vec4<Scalar>) * mesh.nodes.size(), nullptr, &error),
+                                context, CL_MEM_READ_ONLY, sizeof(vec4<Scalar>) * mesh.size(), nullptr, &error),
                               ::clReleaseMemObject);
 
                     // Flatten our rays
                     std::vector<vec4<Scalar>> rays;
-                    rays.reserve(mesh.nodes.size());
-                    for (const auto& n : mesh.nodes) {
-                        rays.emplace_back(vec4<Scalar>{n.ray[0], n.ray[1], n.ray[2], 0});
+                    rays.reserve(mesh.size());
+                    for (unsigned int i = 0; i < mesh.size(); ++i) {
+                        const vec3<Scalar> ray = mesh.ray(i);
+                        rays.emplace_back(vec4<Scalar>{ray[0], ray[1], ray[2], 0});
                     }
 
                     // Write the points buffer to the device and cache it
@@ -507,10 +510,7 @@ namespace engine {
                     throw_cl_error(error, "Error writing points to the device buffer");
 
                     // Cache for future runs
-                    device_points_cache[&mesh] = cl_points;
-                }
-                else {
-                    cl_points = device_mesh->second;
+                    device_points_cache[mesh.id()] = cl_points;
                 }
 
                 // First count the size of the buffer we will need to allocate
@@ -559,8 +559,8 @@ namespace engine {
                     case EQUISOLID: projection_kernel = project_equisolid; break;
                 }
 
-                // Calculate the coefficients for performing a distortion to give to the engine
-                vec4<Scalar> ik = inverse_coefficients(lens.k);
+                // The coefficients for performing a distortion to give to the engine
+                vec4<Scalar> ik = prepared_lens.ik;
 
                 // Load the arguments
                 cl_mem arg;
@@ -597,18 +597,17 @@ namespace engine {
 
                 // This can happen on the CPU while the OpenCL device is busy
                 // Build the reverse lookup map where the offscreen point is one past the end
-                std::vector<int> r_indices(nodes.size() + 1, n_points);
+                reverse_index.reset(mesh.size() + 1);
                 for (unsigned int i = 0; i < indices.size(); ++i) {
-                    r_indices[indices[i]] = i;
+                    reverse_index.set(indices[i], i);
                 }
 
                 // Build the packed neighbourhood map with an extra offscreen point at the end
                 std::vector<std::array<int, N_NEIGHBOURS>> local_neighbourhood(n_points + 1);
                 for (unsigned int i = 0; i < indices.size(); ++i) {
-                    const auto& node = nodes[indices[i]];
-                    for (unsigned int j = 0; j < node.neighbours.size(); ++j) {
-                        const auto& n             = node.neighbours[j];
-                        local_neighbourhood[i][j] = r_indices[n];
+                    const auto neighbours = mesh.neighbours(indices[i]);
+                    for (unsigned int j = 0; j < neighbours.size(); ++j) {
+                        local_neighbourhood[i][j] = reverse_index.get(neighbours[j], n_points);
                     }
                 }
                 // Fill in the final offscreen point which connects only to itself
@@ -777,8 +776,16 @@ namespace engine {
             /// The largest preferred workgroup size so we can overallocate memory
             size_t workgroup_size;
 
-            /// Cache of opencl buffers from mesh objects
-            mutable std::map<const void*, cl::mem> device_points_cache;
+            /// Cache of opencl buffers from mesh objects, kept for the two most recent meshes so switching between two
+            /// heights does not upload the rays again every frame
+            mutable util::IdCache<cl::mem> device_points_cache{2};
+            /// The lens used for the previous frame so it only needs to be prepared again when it changes
+            mutable PreparedLens<Scalar> prepared_lens;
+            /// The results of the previous lookup so the next frame only needs to retest what changed, kept only for
+            /// the most recent mesh as it is about half the size of a compact mesh
+            mutable util::IdCache<LookupCache<Scalar>> lookup_cache{1};
+            /// Maps the index of each node to its index in the projected mesh, reused so it never needs clearing
+            mutable util::ReverseIndex reverse_index;
         };
 
     }  // namespace opencl
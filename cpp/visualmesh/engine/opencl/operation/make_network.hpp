@@ -49,7 +49,7 @@ namespace engine {
                 if (structure.empty() || structure.front().empty()) { return ""; }
 
                 // First layer has 4 inputs, so that tells us how many neighbours we have (minus ourself)
-                const unsigned int n_neighbours = (structure.front().front().weights.size() / 4) - 1;
+                const unsigned int n_neighbours = (structure.front().front().packed().rows() / 4) - 1;
 
                 // Set our precision for how many digits our scalar has
                 code << std::setprecision(std::numeric_limits<Scalar>::digits10 + 2);
@@ -108,7 +108,7 @@ namespace engine {
 
                     // Now we have to do our layer operations
                     for (unsigned int layer_no = 0; layer_no < conv.size(); ++layer_no) {
-                        const auto& weights    = conv[layer_no].weights;
+                        const auto weights     = conv[layer_no].packed();
                         const auto& biases     = conv[layer_no].biases;
                         const auto& activation = conv[layer_no].activation;
 
@@ -122,7 +122,7 @@ namespace engine {
                         for (unsigned int i = 0; i < output_dimensions; ++i) {
                             code << "    ";
                             for (unsigned int j = 0; j < input_dimensions; ++j) {
-                                code << "in" << layer_no << "[" << j << "] * " << weights[j][i] << " + ";
+                                code << "in" << layer_no << "[" << j << "] * " << weights(j, i) << " + ";
                             }
                             code << biases[i];
                             if (i + 1 < output_dimensions) { code << ","; }
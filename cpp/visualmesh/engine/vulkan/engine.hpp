@@ -42,8 +42,10 @@
 #include "visualmesh/mesh.hpp"
 #include "visualmesh/network_structure.hpp"
 #include "visualmesh/projected_mesh.hpp"
+#include "visualmesh/utility/id_cache.hpp"
 #include "visualmesh/utility/math.hpp"
 #include "visualmesh/utility/projection.hpp"
+#include "visualmesh/utility/reverse_index.hpp"
 #include "visualmesh/utility/static_if.hpp"
 #include "visualmesh/visualmesh.hpp"
 
@@ -695,7 +697,8 @@ namespace engine {
             inline ProjectedMesh<Scalar, Model<Scalar>::N_NEIGHBOURS> operator()(const VisualMesh<Scalar, Model>& mesh,
                                                                                  const mat4<Scalar>& Hoc,
                                                                                  const Lens<Scalar>& lens) const {
-                return operator()(mesh.height(Hoc[2][3]), Hoc, lens);
+                const auto m = mesh.get(Hoc[2][3]);
+                return operator()(*m, Hoc, lens);
             }
 
             /**
@@ -994,7 +997,8 @@ namespace engine {
                                                                            const Lens<Scalar>& lens,
                                                                            const void* image,
                                                                            const uint32_t& format) const {
-                return operator()(mesh.height(Hoc[2][3]), Hoc, lens, image, format);
+                const auto m = mesh.get(Hoc[2][3]);
+                return operator()(*m, Hoc, lens, image, format);
             }
 
             void clear_cache() {
@@ -1117,17 +1121,12 @@ namespace engine {
                                        reprojection_buffers["vk_dimensions"].second,
                                        0);
 
-                // Convenience variables
-                const auto& nodes = mesh.nodes;
-
                 // Upload our visual mesh unit vectors if we have to
-                std::pair<vk::buffer, vk::device_memory> vk_points;
-
-                auto device_mesh = device_points_cache.find(&mesh);
-                if (device_mesh == device_points_cache.end()) {
+                std::pair<vk::buffer, vk::device_memory> vk_points = device_points_cache[mesh.id()];
+                if (vk_points.first == nullptr) {
                     vk_points = operation::create_buffer(
                       context,
-                      sizeof(vec4<Scalar>) * mesh.nodes.size(),
+                      sizeof(vec4<Scalar>) * mesh.size(),
                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                       VK_SHARING_MODE_EXCLUSIVE,
                       {context.transfer_queue_family},
@@ -1136,20 +1135,15 @@ namespace engine {
                     // Write the points buffer to the device and cache it
                     operation::map_memory<vec4<Scalar>>(
                       context, 0, VK_WHOLE_SIZE, vk_points.second, [&mesh](vec4<Scalar>* payload) {
-                          size_t index = 0;
-                          for (const auto& n : mesh.nodes) {
-                              payload[index] =
-                                vec4<Scalar>{Scalar(n.ray[0]), Scalar(n.ray[1]), Scalar(n.ray[2]), Scalar(0)};
-                              index++;
+                          for (size_t index = 0; index < mesh.size(); ++index) {
+                              const vec3<Scalar> ray = mesh.ray(index);
+                              payload[index]         = vec4<Scalar>{ray[0], ray[1], ray[2], Scalar(0)};
                           }
                       });
                     operation::bind_buffer(context, vk_points.first, vk_points.second, 0);
 
                     // Cache for future runs
-                    device_points_cache[&mesh] = vk_points;
-                }
-                else {
-                    vk_points = device_mesh->second;
+                    device_points_cache[mesh.id()] = vk_points;
                 }
 
                 // First count the size of the buffer we will need to allocate
@@ -1294,18 +1288,17 @@ namespace engine {
 
                 // This can happen on the CPU while the Vulkan device is busy
                 // Build the reverse lookup map where the offscreen point is one past the end
-                std::vector<int> r_indices(nodes.size() + 1, points);
+                reverse_index.reset(mesh.size() + 1);
                 for (unsigned int i = 0; i < indices.size(); ++i) {
-                    r_indices[indices[i]] = i;
+                    reverse_index.set(indices[i], i);
                 }
 
                 // Build the packed neighbourhood map with an extra offscreen point at the end
                 std::vector<std::array<int, N_NEIGHBOURS>> local_neighbourhood(points + 1);
                 for (unsigned int i = 0; i < indices.size(); ++i) {
-                    const auto& node = nodes[indices[i]];
-                    for (unsigned int j = 0; j < node.neighbours.size(); ++j) {
-                        const auto& n             = node.neighbours[j];
-                        local_neighbourhood[i][j] = r_indices[n];
+                    const auto neighbours = mesh.neighbours(indices[i]);
+                    for (unsigned int j = 0; j < neighbours.size(); ++j) {
+                        local_neighbourhood[i][j] = reverse_index.get(neighbours[j], points);
                     }
                 }
                 // Fill in the final offscreen point which connects only to itself
@@ -1565,8 +1558,11 @@ namespace engine {
             // The width of the maximumally wide layer in the network
             size_t max_width;
 
-            // Cache of Vulkan buffers from mesh objects
-            mutable std::map<const void*, std::pair<vk::buffer, vk::device_memory>> device_points_cache;
+            // Cache of Vulkan buffers from mesh objects, kept for the two most recent meshes so switching between two
+            // heights does not upload the rays again every frame
+            mutable util::IdCache<std::pair<vk::buffer, vk::device_memory>> device_points_cache{2};
+            // Maps the index of each node to its index in the projected mesh, reused so it never needs clearing
+            mutable util::ReverseIndex reverse_index;
         };
 
     }  // namespace vulkan
@@ -55,7 +55,7 @@ namespace engine {
                 uint32_t output_dimensions = 0;
 
                 // First layer has 4 inputs, so that tells us how many neighbours we have (minus ourself)
-                const uint32_t n_neighbours = (structure.front().front().weights.size() / 4) - 1;
+                const uint32_t n_neighbours = (structure.front().front().packed().rows() / 4) - 1;
 
                 for (uint32_t conv_no = 0; conv_no < structure.size(); ++conv_no) {
                     auto& conv = structure[conv_no];
@@ -278,8 +278,8 @@ namespace engine {
 
                     // Now we have to do our layer operations
                     for (uint32_t layer_no = 0; layer_no < conv.size(); ++layer_no) {
-                        const auto& weights = conv[layer_no].weights;
-                        const auto& biases  = conv[layer_no].biases;
+                        const auto weights = conv[layer_no].packed();
+                        const auto& biases = conv[layer_no].biases;
 
                         output_dimensions = biases.size();
 
@@ -309,7 +309,7 @@ namespace engine {
 
                                 current_val = program.add_name(
                                   program.fmul(
-                                    current_val, program.add_constant(float_type, {weights[j][i]}), float_type),
+                                    current_val, program.add_constant(float_type, {weights(j, i)}), float_type),
                                   "current_mul_weight");
 
                                 program.add_source_line(__FILE__, __LINE__, conv_no);
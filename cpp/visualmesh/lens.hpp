@@ -51,6 +51,19 @@ struct Lens {
     Scalar fov;
 };
 
+/// If two lenses have all the same parameters
+template <typename Scalar>
+inline bool operator==(const Lens<Scalar>& a, const Lens<Scalar>& b) {
+    return a.dimensions == b.dimensions && a.projection == b.projection && a.focal_length == b.focal_length
+           && a.centre == b.centre && a.k == b.k && a.fov == b.fov;
+}
+
+/// If two lenses differ in any of their parameters
+template <typename Scalar>
+inline bool operator!=(const Lens<Scalar>& a, const Lens<Scalar>& b) {
+    return !(a == b);
+}
+
 }  // namespace visualmesh
 
 #endif  // VISUALMESH_LENS_HPP
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_LOOKUP_CACHE_HPP
+#define VISUALMESH_LOOKUP_CACHE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "lens.hpp"
+#include "utility/math.hpp"
+#include "utility/projection.hpp"
+
+namespace visualmesh {
+
+// Forward declare the mesh so it can be a friend
+template <typename Scalar, template <typename> class Model>
+class Mesh;
+
+namespace detail {
+    /// Get a new id for a mesh, which is unique among all the meshes that are created in this process
+    inline uint64_t next_mesh_id() {
+        static std::atomic<uint64_t> next(1);
+        return next++;
+    }
+}  // namespace detail
+
+/**
+ * @brief Remembers the results of a Mesh lookup so the next lookup only needs to retest what may have changed
+ *
+ * @details
+ *  Every test that the lookup does (for both the elements of the BSP tree and the individual points) compares a value
+ *  that moves continuously as the camera rotates against a fixed threshold. When a test is done, the cache stores its
+ *  result along with how far the camera would need to rotate before the result could change. This slack comes from the
+ *  distance to each threshold, as no direction can move by more than the angle the camera rotates by, and for the
+ *  pixel coordinate tests from a bound on how quickly a pixel can move as its ray rotates.
+ *
+ *  Between lookups the cache accumulates the angle the camera has rotated through. Any stored result whose slack has
+ *  not been used up is reused without retesting, so the amount of work done per frame depends on how far the camera
+ *  moved and the ranges that are returned are identical to an uncached lookup. The translation of the camera does not
+ *  affect the lookup, and a change in the lens or the mesh that is used resets the cache.
+ *
+ *  A cache can only hold the results for a single mesh, so use one cache for each mesh that is looked up every frame.
+ *  It uses about 8 bytes for each node and 9 bytes for each element of the BSP tree of that mesh, which is around half
+ *  the size of a compact mesh.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+class LookupCache {
+public:
+    /// Forget all the stored results so that the next lookup retests everything
+    void reset() {
+        mesh = 0;
+    }
+
+private:
+    /// The states that a BSP element can be in
+    enum State : uint8_t { PARTIAL = 0, INSIDE = 1, OUTSIDE = 2 };
+
+    /**
+     * @brief Prepare the cache for a lookup, resetting it if anything other than the rotation has changed
+     *
+     * @param id      the id of the mesh that is being looked up
+     * @param n_nodes the number of nodes in the mesh
+     * @param n_bsp   the number of elements in the mesh's BSP tree
+     * @param Rco     the rotation from the observation plane to the camera for this lookup
+     * @param lens    the lens that is being used for this lookup
+     */
+    void update(const uint64_t& id,
+                const std::size_t& n_nodes,
+                const std::size_t& n_bsp,
+                const mat3<Scalar>& Rco,
+                const Lens<Scalar>& lens) {
+
+        if (id != mesh || n_nodes != node_until.size() || n_bsp != bsp_until.size() || lens != this->lens) {
+            mesh        = id;
+            this->lens  = lens;
+            odometer    = 0;
+            pixel_speed = max_pixel_speed(lens);
+
+            // Negative so that nothing is valid
+            node_until.assign(n_nodes, -1.0);
+            node_state.assign(n_nodes, false);
+            bsp_until.assign(n_bsp, -1.0);
+            bsp_state.assign(n_bsp, PARTIAL);
+        }
+        else {
+            // Work out the angle we have rotated by since the last lookup, using the distance between the rotation
+            // matrices as it is much more accurate for small angles than using the trace
+            double distance = 0.0;
+            for (int i = 0; i < 3; ++i) {
+                for (int j = 0; j < 3; ++j) {
+                    const double d = double(Rco[i][j]) - double(this->Rco[i][j]);
+                    distance += d * d;
+                }
+            }
+            odometer += 2.0 * std::asin(std::min(1.0, std::sqrt(distance) / (2.0 * std::sqrt(2.0))));
+        }
+
+        this->Rco = Rco;
+    }
+
+    /// If the stored result for a BSP element can be used
+    bool bsp_valid(const int& i) const {
+        return odometer < bsp_until[i];
+    }
+
+    /// If the stored result for a node can be used
+    bool node_valid(const int& i) const {
+        return odometer < node_until[i];
+    }
+
+    /// Store the result for a BSP element that will stay valid until the camera rotates by slack radians
+    void store_bsp(const int& i, const bool& inside, const bool& outside, const Scalar& slack) {
+        bsp_state[i] = inside ? INSIDE : outside ? OUTSIDE : PARTIAL;
+        bsp_until[i] = odometer + (slack - epsilon());
+    }
+
+    /// Store the result for a node that will stay valid until the camera rotates by slack radians
+    void store_node(const int& i, const bool& on_screen, const Scalar& slack) {
+        node_state[i] = on_screen;
+        node_until[i] = odometer + (slack - epsilon());
+    }
+
+    /// A margin taken off every slack so that rounding errors in the tests cannot change their result
+    static constexpr Scalar epsilon() {
+        return std::numeric_limits<Scalar>::epsilon() < Scalar(1e-10) ? Scalar(1e-7) : Scalar(1e-4);
+    }
+
+    /**
+     * @brief Calculate an upper bound on how many pixels a ray within the lens's field of view can move for each
+     *        radian that it rotates
+     *
+     * @details
+     *  A ray at angle theta from the camera axis projects at radius r(theta) in the image, so when it rotates it moves
+     *  by at most r'(theta) pixels per radian towards the centre or r(theta) / sin(theta) pixels per radian around it.
+     *  The largest value of each of these within the field of view is used, and the distortion is then bounded over all
+     *  the radii up to the edge of the field of view.
+     *
+     * @param lens the lens to calculate the bound for
+     *
+     * @return the maximum speed in pixels per radian, or infinity if the lens has no bound
+     */
+    static Scalar max_pixel_speed(const Lens<Scalar>& lens) {
+        const Scalar& f    = lens.focal_length;
+        const Scalar theta = lens.fov * Scalar(0.5);
+
+        Scalar radial;
+        Scalar tangential;
+        Scalar r;
+        switch (lens.projection) {
+            case RECTILINEAR: {
+                if (!(theta < Scalar(M_PI_2))) { return std::numeric_limits<Scalar>::infinity(); }
+                radial     = f / (std::cos(theta) * std::cos(theta));
+                tangential = f / std::cos(theta);
+                r          = rectilinear::r(theta, f);
+            } break;
+            case EQUISOLID: {
+                if (!(theta < Scalar(M_PI))) { return std::numeric_limits<Scalar>::infinity(); }
+                radial     = f;
+                tangential = f / std::cos(theta * Scalar(0.5));
+                r          = equisolid::r(theta, f);
+            } break;
+            case EQUIDISTANT: {
+                if (!(theta < Scalar(M_PI))) { return std::numeric_limits<Scalar>::infinity(); }
+                radial     = f;
+                tangential = theta > Scalar(0) ? f * theta / std::sin(theta) : f;
+                r          = equidistant::r(theta, f);
+            } break;
+            default: return std::numeric_limits<Scalar>::infinity();
+        }
+
+        // The distortion multiplies the radius by a polynomial p(r^2) and its derivative by (r p(r^2))' so bound both
+        const vec4<Scalar> ik = inverse_coefficients(lens.k);
+        Scalar scale          = 1;
+        Scalar derivative     = 1;
+        Scalar x              = r * r;
+        for (int i = 0; i < 4; ++i) {
+            scale += std::abs(ik[i]) * x;
+            derivative += Scalar(2 * i + 3) * std::abs(ik[i]) * x;
+            x *= r * r;
+        }
+
+        return std::max(radial * derivative, tangential * scale);
+    }
+
+    /// The id of the mesh the stored results are for, or 0 if there are none
+    uint64_t mesh = 0;
+    /// The lens that the stored results were made with
+    Lens<Scalar> lens{};
+    /// The rotation used in the previous lookup
+    mat3<Scalar> Rco{};
+    /// The total angle the camera has rotated through since the cache was reset
+    double odometer = 0.0;
+    /// An upper bound on how many pixels a point on screen can move for each radian the camera rotates
+    Scalar pixel_speed = 0;
+
+    /// The odometer value at which the stored result for each node may no longer be valid
+    std::vector<double> node_until;
+    /// If each node was on the screen
+    std::vector<bool> node_state;
+    /// The odometer value at which the stored result for each BSP element may no longer be valid
+    std::vector<double> bsp_until;
+    /// The state of each BSP element
+    std::vector<State> bsp_state;
+
+    template <typename S, template <typename> class M>
+    friend class Mesh;
+};
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_LOOKUP_CACHE_HPP
@@ -20,25 +20,119 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cmath>
-#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iterator>
 #include <limits>
 #include <numeric>
+#include <random>
+#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <thread>
 #include <tuple>
 #include <type_traits>
+#include <typeinfo>
 #include <utility>
 #include <vector>
 
+#include "compact_nodes.hpp"
 #include "lens.hpp"
+#include "lookup_cache.hpp"
 #include "node.hpp"
+#include "prepared_lens.hpp"
 #include "utility/cone.hpp"
+#include "utility/fourcc.hpp"
 #include "utility/math.hpp"
 #include "utility/projection.hpp"
+#include "utility/thread_pool.hpp"
 
 namespace visualmesh {
 
+/**
+ * @brief The layout of a cached mesh file
+ *
+ * @details
+ *  All values are stored in the byte order of the machine that wrote the file. The file starts with a Header, followed
+ *  by the nodes of the mesh exactly as they are stored in memory, and then a BSPEntry for each element of the BSP tree.
+ *  The key in the header is a hash of everything that was used to generate the mesh, so a cached file is only used if
+ *  it was generated from the same model, shape, h, k and max_distance.
+ */
+namespace mesh_file {
+
+    /// The magic number at the start of every mesh file
+    constexpr uint32_t MAGIC = fourcc("VMMS");
+    /// The current version of the file format
+    constexpr uint32_t VERSION = 4;
+    /// Written as a single value so a file with a different byte order can be detected
+    constexpr uint32_t ORDER_MARK = 0x01020304;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t order_mark;
+        /// The number of bytes in each scalar, 4 for float and 8 for double
+        uint32_t scalar_size;
+        /// The hash of the parameters that were used to generate this mesh
+        uint64_t key;
+        /// The number of neighbours each node has
+        uint32_t n_neighbours;
+        /// The number of nodes in the mesh
+        uint32_t n_nodes;
+        /// The number of elements in the BSP tree
+        uint32_t n_bsp;
+        uint32_t reserved;
+        /// Offset from the start of the file to the nodes
+        uint64_t nodes_offset;
+        /// Offset from the start of the file to the BSP tree
+        uint64_t bsp_offset;
+    };
+
+    template <typename Scalar>
+    struct BSPEntry {
+        int32_t range[2];
+        /// The index of the first child, the second child is the entry after it. -1 for a leaf
+        int32_t children;
+        Scalar axis[3];
+        Scalar cos_theta;
+        Scalar sin_theta;
+    };
+
+    /// Hash some bytes using 64 bit FNV-1a, continuing from a previous hash
+    inline uint64_t hash(const void* data, const std::size_t& size, uint64_t h = 0xcbf29ce484222325) {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        for (std::size_t i = 0; i < size; ++i) {
+            h = (h ^ bytes[i]) * 0x100000001b3;
+        }
+        return h;
+    }
+
+    /**
+     * @brief Make a name for a temporary file to write path through that no other thread or process will be using
+     *
+     * @details
+     *  Each process picks a random tag the first time this is called and each call in the process gets the next value
+     *  of a counter, so threads or processes that are generating the same mesh at the same time never share a file.
+     */
+    inline std::string temporary_path(const std::string& path) {
+        static const uint64_t tag = [] {
+            std::random_device rd;
+            return uint64_t(rd()) << 32 | uint64_t(rd());
+        }();
+        static std::atomic<uint64_t> counter(0);
+
+        std::stringstream name;
+        name << path << "." << std::hex << tag << "." << counter++ << ".tmp";
+        return name.str();
+    }
+
+}  // namespace mesh_file
+
 /**
  * @brief Holds a description of a Visual Mesh
  *
@@ -55,16 +149,39 @@ namespace visualmesh {
  */
 template <typename Scalar, template <typename> class Model>
 class Mesh {
+public:
+    /// A range of points that are on screen and where the pixel coordinates for them are if the lookup projected them
+    struct Segment {
+        /// The start and one past the end of the points
+        std::pair<int, int> range;
+        /// The index of the pixel coordinate for the first point, or -1 if the points were not projected
+        int pixels;
+    };
+
 private:
+    /**
+     * @brief A node that is being sorted into the BSP tree along with a copy of its ray, so that the tree can be
+     *        built by moving through the points in order rather than jumping around the list of nodes
+     */
+    struct TreePoint {
+        /// The unit vector pointing from the camera to the node
+        vec3<Scalar> ray;
+        /// The x component of the ray divided by its length in the x/y plane, which is nan if the ray is vertical
+        Scalar theta;
+        /// The index of the node in the list of nodes
+        int index;
+    };
+
     /**
      * @brief An element of a binary search partitioning scheme to quickly work out which points are on the screen.
      *
      * @details
      *  This is a node in a binary search partition. It is represented by a bounding cone that can be used to work out
      * if any of the elements in that cone are on the screen. These cones will be split into sub cones to further limit
-     * the scope of the search until a list of a few elements are found that can be checked manually.
+     * the scope of the search until a list of a few elements are found that can be checked manually. This is the form
+     * the tree is built in before it is flattened into the BSP that is used for lookups.
      */
-    struct BSP {
+    struct TreeElement {
         // The bounds of the range that this BSP element represents (start to one past the end)
         std::pair<int, int> range;
         // The indicies of the two children in this BSP
@@ -79,32 +196,86 @@ private:
         //      \|/
         //       V
         std::pair<vec3<Scalar>, vec2<Scalar>> cone;
+        // The nodes that lie on the boundary of the cone, used to seed the cone of the parent (-1 when unused)
+        std::array<int, 3> support;
+    };
+
+    /**
+     * @brief An element of the flattened BSP tree that is used for lookups
+     *
+     * @details
+     *  The two children of an element are always stored next to each other so only the index of the first is needed,
+     *  which keeps each element to 32 bytes for float meshes. The elements are stored in depth first order with each
+     *  pair of siblings placed together, so the elements that a lookup visits one after another are close in memory.
+     */
+    struct BSP {
+        // The bounds of the range that this BSP element represents (start to one past the end)
+        std::pair<int, int> range;
+        // The index of the first child of this element, the second child is the element after it. -1 for a leaf
+        int children;
+        // The unit axis of the cone in world space, and the cos and sin of the cone angle
+        std::pair<vec3<Scalar>, vec2<Scalar>> cone;
     };
 
+    /// Make the point that is used to sort a node into the BSP tree
+    TreePoint tree_point(const int& i) const {
+        const auto& ray = nodes[i].ray;
+        return TreePoint{ray, ray[0] / std::sqrt(1 - ray[2] * ray[2]), i};
+    }
+
     /**
      * @brief Given a set of points, find the smallest cone that contains all points
      *
      * @details
-     *  Implements welzls algorithm for circles, but instead for cones. You should randomize the iterator before running
-     *  this algorithm, otherwise you can suffer from very poor performance
+     *  Implements welzls algorithm for circles, but instead for cones. The algorithm only does extra work when it finds
+     *  a point outside of the cone so far, so it is fastest when the points on the boundary of the cone come first. To
+     *  make this happen the points that are likely to be on the boundary can be given as hints, which are considered
+     *  before the other points. Otherwise you should randomize the iterator before running this algorithm, or you can
+     *  suffer from very poor performance.
      *
-     * @tparam Iterator the type of the iterator passed in
+     * @tparam Iterator the type of the iterator passed in, must evaluate to an object of type TreePoint
      *
-     * @param start the start iterator of points to consider for the circle
-     * @param end   the end iterator of points to consider for the circle
+     * @param start   the start iterator of points to consider for the circle
+     * @param end     the end iterator of points to consider for the circle
+     * @param hints   points from between start and end to consider first
+     * @param support set to the points that lie on the boundary of the cone, with -1 for any that are unused
      */
     template <typename Iterator>
-    std::pair<vec3<Scalar>, vec2<Scalar>> bounding_cone(Iterator start, Iterator end) {
+    std::pair<vec3<Scalar>, vec2<Scalar>> bounding_cone(Iterator start,
+                                                        Iterator end,
+                                                        const std::vector<TreePoint>& hints,
+                                                        std::array<int, 3>& support) {
+        const int n_hints = hints.size();
+        const int n       = n_hints + std::distance(start, end);
+        auto point        = [&](const int& i) -> const TreePoint& {
+            return i < n_hints ? hints[i] : start[i - n_hints];
+        };
+
+        // The hints appear again between start and end, and using the same point twice would make a degenerate cone.
+        // This only needs to be checked for points that are outside the cone which is rare.
+        auto repeated = [&](const int& i) {
+            return i >= n_hints && std::any_of(hints.begin(), hints.end(), [&](const TreePoint& h) {
+                       return h.index == point(i).index;
+                   });
+        };
+
         std::pair<vec3<Scalar>, Scalar> cone(cone_from_points<Scalar>());
-        for (auto i = start; i < end; ++i) {
-            if (dot(cone.first, nodes[*i].ray) < cone.second) {
-                cone = cone_from_points(nodes[*i].ray);
-                for (auto j = start; j < i; ++j) {
-                    if (dot(cone.first, nodes[*j].ray) < cone.second) {
-                        cone = cone_from_points(nodes[*i].ray, nodes[*j].ray);
-                        for (auto k = start; k < j; ++k) {
-                            if (dot(cone.first, nodes[*k].ray) < cone.second) {
-                                cone = cone_from_points(nodes[*i].ray, nodes[*j].ray, nodes[*k].ray);
+        support = {{-1, -1, -1}};
+        for (int i = 0; i < n; ++i) {
+            const TreePoint& a = point(i);
+            if (dot(cone.first, a.ray) < cone.second && !repeated(i)) {
+                cone    = cone_from_points(a.ray);
+                support = {{a.index, -1, -1}};
+                for (int j = 0; j < i; ++j) {
+                    const TreePoint& b = point(j);
+                    if (dot(cone.first, b.ray) < cone.second && !repeated(j)) {
+                        cone    = cone_from_points(a.ray, b.ray);
+                        support = {{a.index, b.index, -1}};
+                        for (int k = 0; k < j; ++k) {
+                            const TreePoint& c = point(k);
+                            if (dot(cone.first, c.ray) < cone.second && !repeated(k)) {
+                                cone    = cone_from_points(a.ray, b.ray, c.ray);
+                                support = {{a.index, b.index, c.index}};
                             }
                         }
                     }
@@ -125,72 +296,79 @@ private:
      * binary search partitioning scheme. These partitions are described using bounding cones which can then be used to
      * include or throw out points on mass
      *
-     * @tparam Iterator the type of the iterator passed in, must evalute to an object of type Node
+     * The bounding cone of each element is found after its children are built, starting from the points on the boundary
+     * of the children's cones so that it only takes a little more than one pass over the points. Large partitions build
+     * their two children in parallel, each into a separate tree that is then appended to this one. The order of the
+     * elements in the tree depends on the concurrency, however flattening it gives the same BSP every time.
      *
+     * @tparam Iterator the type of the iterator passed in, must evaluate to an object of type TreePoint
+     *
+     * @param tree        the tree to add the elements of the bsp to
      * @param start       the start iterator of points to sort into the bsp
      * @param end         the end iterator of points to sort into the bsp
+     * @param pool        the thread pool that is used to build large partitions in parallel
      * @param min_points  the number of points that the algorithm terminates at
      * @param offset      the offset from the start of the nodes list to the region this BSP node represents
+     * @param depth       the depth of this BSP node in the tree, with the root at 0
      */
     template <typename Iterator>
-    int build_bsp(Iterator start, Iterator end, int min_points = 8, int offset = 0) {
+    int build_bsp(std::vector<TreeElement>& tree,
+                  Iterator start,
+                  Iterator end,
+                  util::ThreadPool& pool,
+                  int min_points = 8,
+                  int offset     = 0,
+                  int depth      = 0) {
+        // Partitions with more points than this build their children in parallel
+        constexpr int parallel_points = 16384;
+
         // No points in this partition, this should never happen
         if (std::distance(start, end) == 0) { throw std::runtime_error("We tried to make a tree with no nodes"); }
 
+        const std::pair<int, int> range(offset, static_cast<int>(offset + std::distance(start, end)));
+
         // If we have few enough points, terminate the search here and return what we have. It can be cheaper to project
         // a list of pixels than to do more BSP steps. This also makes it cheaper to build the BSP and less memory to
         // store.
         if (std::distance(start, end) <= min_points) {
-            int elem = bsp.size();
+            int elem = tree.size();
 
             // Add this element with children -1,-1 to signify it has no children
-            bsp.push_back(BSP{std::make_pair(offset, static_cast<int>(offset + std::distance(start, end))),
-                              {{-1, -1}},
-                              bounding_cone(start, end)});
+            std::array<int, 3> support;
+            const auto cone = bounding_cone(start, end, {}, support);
+            tree.push_back(TreeElement{range, {{-1, -1}}, cone, support});
 
             // By default, sort by index that they were generated with to remove the remaining randomness
-            std::sort(start, end);
+            std::sort(start, end, [](const TreePoint& a, const TreePoint& b) { return a.index < b.index; });
 
             return elem;
         }
+
+        std::pair<vec3<Scalar>, vec2<Scalar>> cone;
+        Iterator mid;
+
         // We treat the first element specially
-        else if (bsp.empty()) {
+        if (depth == 0) {
             // The first tree is always a split in the theta angle, and it split between +y from -y so that future loops
             // can sort purely based on x value making for a faster algorithm
 
             // Find the largest phi value for making the cone
-            auto max_phi_element = std::max_element(start, end, [this](const int& a, const int& b) {
-                return nodes[a].ray[2] < nodes[b].ray[2];  // comparing z is the same as comparing phi
+            auto max_phi_element = std::max_element(start, end, [](const TreePoint& a, const TreePoint& b) {
+                return a.ray[2] < b.ray[2];  // comparing z is the same as comparing phi
             });
 
             // Negate as we would be dotting with the -z axis to get the angle
-            const Scalar cone_cos = -nodes[*max_phi_element].ray[2];
+            const Scalar cone_cos = -max_phi_element->ray[2];
             const Scalar cone_sin = std::sqrt(1 - cone_cos * cone_cos);
 
             // The cone will have a known axis (the -z axis) and our cos and sin theta come from the most positive z
             // value
-            std::pair<vec3<Scalar>, vec2<Scalar>> cone =
-              std::make_pair(vec3<Scalar>{0, 0, -1}, vec2<Scalar>{cone_cos, cone_sin});
+            cone = std::make_pair(vec3<Scalar>{0, 0, -1}, vec2<Scalar>{cone_cos, cone_sin});
 
             // Partition based on the sign of the y component
-            Iterator mid = std::partition(start, end, [this](const int& a) { return nodes[a].ray[1] > 0; });
-
-            bsp.push_back(BSP{
-              std::make_pair(offset, static_cast<int>(std::distance(start, end))),
-              {{-1, -1}},
-              cone,
-            });
-            bsp.front().children = {{
-              build_bsp(start, mid, min_points, 0),
-              build_bsp(mid, end, min_points, std::distance(start, mid)),
-            }};
-            return 0;
+            mid = std::partition(start, end, [](const TreePoint& a) { return a.ray[1] > 0; });
         }
         else {
-            // Calculate our bounding cone for this cluster. We have to do a random sort of our segment here so that the
-            // performance of the bounding cone algorithm is expected to be linear
-            auto cone = bounding_cone(start, end);
-
             // Find the extents of our data
             Scalar min_phi   = std::numeric_limits<Scalar>::max();
             Scalar max_phi   = std::numeric_limits<Scalar>::lowest();
@@ -202,9 +380,8 @@ private:
             int count_phi    = 0;
 
             for (auto it = start; it != end; ++it) {
-                const auto& ray    = nodes[*it].ray;
-                const auto& phi    = ray[2];
-                const Scalar theta = ray[0] / std::sqrt(1 - ray[2] * ray[2]);
+                const auto& phi   = it->ray[2];
+                const auto& theta = it->theta;
 
                 min_phi = std::min(min_phi, phi);
                 max_phi = std::max(max_phi, phi);
@@ -224,27 +401,148 @@ private:
             Scalar split_theta = sum_theta / count_theta;
 
             // Partition based on either phi or theta
-            Iterator mid =
+            mid =
               max_phi - min_phi > max_theta - min_theta
-                ? std::partition(start, end, [this, &split_phi](const int& a) { return nodes[a].ray[2] > split_phi; })
-                : std::partition(start, end, [this, &split_theta](const int& a) {
+                ? std::partition(start, end, [&split_phi](const TreePoint& a) { return a.ray[2] > split_phi; })
+                : std::partition(start, end, [&split_theta](const TreePoint& a) {
                       // If an origin point is in here, this will be nan, which means the origin point will always
                       // evaluate false here therefore going to one of the partitions
-                      return nodes[a].ray[0] / std::sqrt(1 - nodes[a].ray[2] * nodes[a].ray[2]) < split_theta;
+                      return a.theta < split_theta;
                   });
+        }
 
-            int elem = bsp.size();
-            bsp.push_back(BSP{
-              std::make_pair(offset, static_cast<int>(offset + std::distance(start, end))),
-              {{-1, -1}},
-              cone,
+        int elem = tree.size();
+        tree.push_back(TreeElement{range, {{-1, -1}}, cone, {{-1, -1, -1}}});
+
+        const std::array<Iterator, 3> bounds = {{start, mid, end}};
+        const std::array<int, 2> offsets     = {{offset, static_cast<int>(offset + std::distance(start, mid))}};
+        std::array<int, 2> children;
+        if (pool.concurrency() > 1 && std::distance(start, end) > parallel_points) {
+            std::array<std::vector<TreeElement>, 2> halves;
+            pool.parallel_for(0, 2, 1, [&](const int& first, const int& last) {
+                for (int c = first; c < last; ++c) {
+                    build_bsp(halves[c], bounds[c], bounds[c + 1], pool, min_points, offsets[c], depth + 1);
+                }
             });
-            bsp[elem].children = {{
-              build_bsp(start, mid, min_points, offset),
-              build_bsp(mid, end, min_points, offset + std::distance(start, mid)),
-            }};
-            return elem;
+
+            // Each half has its root first, and its children need to be moved to where it is put in our tree
+            for (int c = 0; c < 2; ++c) {
+                children[c] = tree.size();
+                for (auto el : halves[c]) {
+                    if (el.children[0] >= 0) {
+                        el.children[0] += children[c];
+                        el.children[1] += children[c];
+                    }
+                    tree.push_back(el);
+                }
+            }
+        }
+        else {
+            for (int c = 0; c < 2; ++c) {
+                children[c] = build_bsp(tree, bounds[c], bounds[c + 1], pool, min_points, offsets[c], depth + 1);
+            }
+        }
+        tree[elem].children = children;
+
+        // The root has a fixed cone, otherwise find the cone starting from the points that bound our children
+        if (depth > 0) {
+            std::vector<TreePoint> hints;
+            for (const auto& c : children) {
+                for (const auto& i : tree[c].support) {
+                    auto same = [&](const TreePoint& h) { return h.index == i; };
+                    if (i >= 0 && std::none_of(hints.begin(), hints.end(), same)) { hints.push_back(tree_point(i)); }
+                }
+            }
+            tree[elem].cone = bounding_cone(start, end, hints, tree[elem].support);
         }
+
+        return elem;
+    }
+
+    /**
+     * @brief Reorder the points of a tree built by build_bsp so that points that are close on the sphere are close in
+     *        the list of nodes
+     *
+     * @details
+     *  The tree only fixes which points are in each element, so the two children of any element can go in either order
+     *  without changing the BSP. The tree is walked depth first, and at each element the children are put in whichever
+     *  order starts closest to where the previous subtree ended and ends closest to where the next subtree starts. Much
+     *  like a Hilbert curve this makes the walk move continuously over the sphere, so that most of a node's neighbours
+     *  are only a few nodes away from it which makes gathering them for each layer of a network more cache friendly.
+     *  The points within each leaf are chained from the point closest to where the previous leaf ended.
+     *
+     * @param tree     the tree to reorder, its children are swapped and its ranges are updated to the new order
+     * @param t        the element of the tree to reorder
+     * @param points   the points in the order they were sorted into the tree
+     * @param ordered  the list to add the reordered points to
+     * @param position the ray of the last point that was added to ordered
+     * @param next     the axis of the element that will be reordered after this one, or a zero vector if none will
+     */
+    static void order_tree(std::vector<TreeElement>& tree,
+                           const int& t,
+                           const std::vector<TreePoint>& points,
+                           std::vector<TreePoint>& ordered,
+                           vec3<Scalar>& position,
+                           const vec3<Scalar>& next) {
+        const int start = ordered.size();
+        auto& el        = tree[t];
+
+        if (el.children[0] < 0) {
+            // Repeatedly move whichever of the remaining points is closest to the last one that was placed up next
+            ordered.insert(ordered.end(), points.begin() + el.range.first, points.begin() + el.range.second);
+            for (auto it = ordered.begin() + start; it != ordered.end(); ++it) {
+                std::iter_swap(it, std::max_element(it, ordered.end(), [&](const TreePoint& a, const TreePoint& b) {
+                    return dot(a.ray, position) < dot(b.ray, position);
+                }));
+                position = it->ray;
+            }
+        }
+        else {
+            // Try the children in both orders and use the one with the least distance to the things around them
+            const vec3<Scalar>& a = tree[el.children[0]].cone.first;
+            const vec3<Scalar>& b = tree[el.children[1]].cone.first;
+            if (dot(position, b) + dot(a, next) > dot(position, a) + dot(b, next)) {
+                std::swap(el.children[0], el.children[1]);
+            }
+            const std::array<int, 2> children = el.children;
+            order_tree(tree, children[0], points, ordered, position, tree[children[1]].cone.first);
+            order_tree(tree, children[1], points, ordered, position, next);
+        }
+
+        el.range = std::make_pair(start, static_cast<int>(ordered.size()));
+    }
+
+    /**
+     * @brief Flatten a tree built by build_bsp into the BSP that is used for lookups
+     *
+     * @param tree the tree to flatten, with the root as its first element
+     *
+     * @return the flattened BSP tree with the root as its first element
+     */
+    static std::vector<BSP> flatten(const std::vector<TreeElement>& tree) {
+        std::vector<BSP> bsp(1);
+        bsp.reserve(tree.size());
+
+        // Place each element and then both of its children, going depth first so the first child's subtree comes
+        // straight after its sibling
+        std::vector<std::pair<int, int>> stack(1, std::make_pair(0, 0));
+        while (!stack.empty()) {
+            const int t    = stack.back().first;
+            const int i    = stack.back().second;
+            const auto& el = tree[t];
+            stack.pop_back();
+
+            int children = -1;
+            if (el.children[0] >= 0) {
+                children = bsp.size();
+                bsp.resize(bsp.size() + 2);
+                stack.emplace_back(el.children[1], children + 1);
+                stack.emplace_back(el.children[0], children);
+            }
+            bsp[i] = BSP{el.range, children, el.cone};
+        }
+
+        return bsp;
     }
 
     /**
@@ -258,12 +556,12 @@ private:
      *  pixels typically in the overselection rather than underselection.
      *
      * @param Hoc   the homogenous transformation matrix that transforms from camera space to observation plane space
-     * @param lens  the lens object describing the type and geometry of the lens that is used
+     * @param lens  the prepared lens describing the type and geometry of the lens that is used
      *
      * @return The cones that best describe the edges of the camera
      */
     static std::array<std::pair<vec3<Scalar>, vec2<Scalar>>, 4> screen_edges(const mat4<Scalar> Hoc,
-                                                                             const Lens<Scalar>& lens) {
+                                                                             const PreparedLens<Scalar>& lens) {
 
         // Extract our rotation matrix
         const mat3<Scalar> Roc = {{
@@ -279,17 +577,15 @@ private:
          * <- y
          */
 
-        // Unproject each of the four corners of the screen and rotate them into world space
-        // Add a 1 pixel offset from the edge so that we don't go over the edge from rounding errors
-        const vec2<Scalar> dimensions          = subtract(cast<Scalar>(lens.dimensions), Scalar(1.0));
+        // Rotate the four corners of the screen that were unprojected when the lens was prepared into world space
         const std::array<vec3<Scalar>, 4> rNCo = {{
-          multiply(Roc, visualmesh::unproject(vec2<Scalar>{1, 1}, lens)),                          // rTCo
-          multiply(Roc, visualmesh::unproject(vec2<Scalar>{dimensions[0], 1}, lens)),              // rUCo
-          multiply(Roc, visualmesh::unproject(vec2<Scalar>{dimensions[0], dimensions[1]}, lens)),  // rVCo
-          multiply(Roc, visualmesh::unproject(vec2<Scalar>{1, dimensions[1]}, lens)),              // rWCo
+          multiply(Roc, lens.corners[0]),  // rTCo
+          multiply(Roc, lens.corners[1]),  // rUCo
+          multiply(Roc, lens.corners[2]),  // rVCo
+          multiply(Roc, lens.corners[3]),  // rWCo
         }};
 
-        switch (lens.projection) {
+        switch (lens.lens.projection) {
             case LensProjection::RECTILINEAR: {
                 // For the case of a plane, we have a cone with a 90 degrees which means cos(theta) = 0 and sin(theta) =
                 // 1
@@ -308,16 +604,12 @@ private:
                  * z        F
                  * <- y
                  */
-                // Get the lens axis centre coordinates
-                vec2<Scalar> centre = add(multiply(dimensions, Scalar(0.5)), lens.centre);
-
-                // Unproject the centre of each of the edges using the lens axis as the centre and rotate into world
-                // space
+                // Rotate the centre of each of the edges, which were unprojected around the lens axis, into world space
                 const std::array<vec3<Scalar>, 4> rECo = {{
-                  multiply(Roc, visualmesh::unproject(vec2<Scalar>{centre[0], 1}, lens)),              // rTCo
-                  multiply(Roc, visualmesh::unproject(vec2<Scalar>{dimensions[0], centre[1]}, lens)),  // rUCo
-                  multiply(Roc, visualmesh::unproject(vec2<Scalar>{centre[0], dimensions[1]}, lens)),  // rVCo
-                  multiply(Roc, visualmesh::unproject(vec2<Scalar>{1, centre[1]}, lens)),              // rWCo
+                  multiply(Roc, lens.edge_centres[0]),  // rDCo
+                  multiply(Roc, lens.edge_centres[1]),  // rECo
+                  multiply(Roc, lens.edge_centres[2]),  // rFCo
+                  multiply(Roc, lens.edge_centres[3]),  // rGCo
                 }};
 
                 // Calculate cones from each of the four screen edges
@@ -348,13 +640,31 @@ private:
         }
     }
 
+    /**
+     * @brief Calculate how many pixels a pixel coordinate would need to move before it changes from being on the screen
+     *        to off it or the other way around
+     *
+     * @param px    the pixel coordinate to check
+     * @param lens  the lens object describing the dimensions of the screen
+     *
+     * @return the distance in pixels to the closest change
+     */
+    static inline Scalar pixel_margin(const vec2<Scalar>& px, const Lens<Scalar>& lens) {
+        // When on screen this is the distance to the closest edge, otherwise the furthest it is past any of the edges
+        return std::abs(std::min(std::min(px[0], lens.dimensions[0] - 1 - px[0]),  //
+                                 std::min(px[1], lens.dimensions[1] - 1 - px[1])));
+    }
+
     /**
      * @brief Check if a point is on the screen, given a description of the edges of the screen as cones, and the axis
      *
      * @param Rco     the 3x3 rotation matrix which rotates from observation plane space to camera space
      * @param cone    the cone object that we are checking if it is on the screen
-     * @param lens    the lens object describing the type and geometry of the lens that is used
+     * @param lens    the prepared lens describing the type and geometry of the lens that is used
      * @param edges   the matrix of 4 cone objects that describe the edge of the screen
+     * @param slack   if not null, set to how far the camera can rotate before the result could change. This is only
+     *                valid while the cone stays inside the field of view of the lens
+     * @param speed   an upper bound on how many pixels a ray inside the field of view moves per radian of rotation
      *
      * @return two booleans that describe if this cone is inside (first) the screen and outside(second) the screen. If
      *         both are true then the cone is intersecting the screen edge.
@@ -362,13 +672,26 @@ private:
     static inline std::pair<bool, bool> check_on_screen(
       const mat3<Scalar>& Rco,
       const std::pair<vec3<Scalar>, vec2<Scalar>>& cone,
-      const Lens<Scalar>& lens,
-      const std::array<std::pair<vec3<Scalar>, vec2<Scalar>>, 4>& edges) {
+      const PreparedLens<Scalar>& lens,
+      const std::array<std::pair<vec3<Scalar>, vec2<Scalar>>, 4>& edges,
+      Scalar* slack       = nullptr,
+      const Scalar& speed = 0) {
 
         // Firstly check if the cone axis is on the screen
         vec2<Scalar> px = ::visualmesh::project(multiply(Rco, cone.first), lens);
         bool axis_on_screen =
-          0 <= px[0] && px[0] + 1 <= lens.dimensions[0] && 0 <= px[1] && px[1] + 1 <= lens.dimensions[1];
+          0 <= px[0] && px[0] + 1 <= lens.lens.dimensions[0] && 0 <= px[1] && px[1] + 1 <= lens.lens.dimensions[1];
+
+        if (slack != nullptr) {
+            // Every test this function does could change its result, so the slack is the smallest margin of them all
+            *slack = pixel_margin(px, lens.lens) / speed;
+            for (int i = 0; i < 4; ++i) {
+                const Scalar angle = dot(cone.first, edges[i].first);
+                const Scalar c     = edges[i].second[0] * cone.second[0];
+                const Scalar s     = edges[i].second[1] * cone.second[1];
+                *slack             = std::min(*slack, std::min(std::abs(angle - (c + s)), std::abs(angle - (c - s))));
+            }
+        }
 
         std::array<Scalar, 4> angles{{
           dot(cone.first, edges[0].first),
@@ -406,54 +729,63 @@ private:
     }
 
 
-public:
     /**
-     * @brief Construct a new Mesh object
-     *
-     * @details
-     *  Constructs a new Mesh object using the provided model type. This mesh object generates a BSP tree and holds the
-     *  logic needed to quickly lookup points that are on screen and return valid index ranges.
+     * @brief Generate the nodes for this mesh from the model, and build the BSP tree for them
      *
-     * @tparam Shape     the type of shape that will be used to generate the Visual Mesh
+     * @tparam Shape the type of shape that will be used to generate the Visual Mesh
      *
-     * @param shape         the shape instance that will be used to generate the Visual Mesh
-     * @param h             the height of the camera above the observation plane
-     * @param k             the number of cross section intersections that are needed for the object
-     * @param max_distance  the maximum distance to generate the Visual Mesh for
+     * @param shape       the shape instance that will be used to generate the Visual Mesh
+     * @param k           the number of cross section intersections that are needed for the object
+     * @param concurrency the number of threads to use when generating the nodes and building the BSP tree
      */
     template <typename Shape>
-    Mesh(const Shape& shape, const Scalar& h, const Scalar& k, const Scalar& max_distance)
-      : h(h), max_distance(max_distance), nodes(Model<Scalar>::generate(shape, h, k, max_distance)) {
+    void build(const Shape& shape, const Scalar& k, const unsigned int& concurrency) {
+        util::ThreadPool pool(concurrency);
+        nodes = Model<Scalar>::generate(shape, h, k, max_distance, pool);
 
         // To ensure that later we can fix the graph we need to perform our sorting on an index list
-        std::vector<int> sorting(nodes.size());
-        std::iota(sorting.begin(), sorting.end(), 0);
+        std::vector<TreePoint> sorting;
+        sorting.reserve(nodes.size());
+        for (unsigned int i = 0; i < nodes.size(); ++i) {
+            sorting.push_back(tree_point(i));
+        }
 
         // We need to shuffle our list to ensure that the bounding cone algorithm has roughly linear performance.
         // We could use std::random_shuffle here but since we only need the list to be "kinda shuffled" so that it's
         // unlikely that we hit the worst case of the bounding cone algorithm. We can actually just shuffle every nth
-        // element and use a fairly bad random number model algorithm
+        // element and use a fairly bad random number model algorithm. The generator is local and always seeded the same
+        // so the mesh is the same every time and meshes can be built on several threads at once.
+        std::minstd_rand rng;
         for (int i = sorting.size() - 1; i > 0; i -= 5) {
-            std::swap(sorting[i], sorting[rand() % i]);
+            std::swap(sorting[i], sorting[rng() % i]);
         }
 
         // Build our bsp tree
         // Reserve enough memory for the bsp as we know how many nodes it will need
-        bsp.reserve(nodes.size() * 2);
-        build_bsp(sorting.begin(), sorting.end());
+        std::vector<TreeElement> tree;
+        tree.reserve(nodes.size() * 2);
+        build_bsp(tree, sorting.begin(), sorting.end(), pool);
+
+        // Lay the points out along a curve over the sphere so neighbouring nodes are close together in memory
+        std::vector<TreePoint> ordered;
+        ordered.reserve(sorting.size());
+        vec3<Scalar> position = tree.front().cone.first;
+        order_tree(tree, 0, sorting, ordered, position, vec3<Scalar>{0, 0, 0});
+        sorting = std::move(ordered);
+        bsp     = flatten(tree);
 
         // Make our reverse lookup so we can correct the neighbourhood indices
         std::vector<int> r_sorting(nodes.size() + 1);
         r_sorting[nodes.size()] = nodes.size();
         for (unsigned int i = 0; i < nodes.size(); ++i) {
-            r_sorting[sorting[i]] = i;
+            r_sorting[sorting[i].index] = i;
         }
 
         // Sort the nodes and correct the neighbourhood graph based on our BSP sorting
         std::vector<Node<Scalar, Model<Scalar>::N_NEIGHBOURS>> sorted_nodes;
         sorted_nodes.reserve(nodes.size());
-        for (const auto& i : sorting) {
-            sorted_nodes.push_back(nodes[i]);
+        for (const auto& p : sorting) {
+            sorted_nodes.push_back(nodes[p.index]);
             for (int& n : sorted_nodes.back().neighbours) {
                 n = r_sorting[n];
             }
@@ -463,46 +795,177 @@ public:
     }
 
     /**
-     * @brief Converts a Mesh object of a different Scalar to this Scalar type
+     * @brief Calculate the key that identifies a mesh generated with these parameters in the cache
+     */
+    template <typename Shape>
+    static uint64_t cache_key(const Shape& shape, const Scalar& h, const Scalar& k, const Scalar& max_distance) {
+        static_assert(std::is_trivially_copyable<Shape>::value, "Shapes must be trivially copyable to be cached");
+
+        const std::string model_name = typeid(Model<Scalar>).name();
+        const std::string shape_name = typeid(Shape).name();
+        uint64_t key                 = mesh_file::hash(model_name.data(), model_name.size());
+        key                          = mesh_file::hash(shape_name.data(), shape_name.size(), key);
+        key                          = mesh_file::hash(&shape, sizeof(Shape), key);
+        key                          = mesh_file::hash(&h, sizeof(Scalar), key);
+        key                          = mesh_file::hash(&k, sizeof(Scalar), key);
+        key                          = mesh_file::hash(&max_distance, sizeof(Scalar), key);
+        return key;
+    }
+
+    /**
+     * @brief Load the nodes and BSP tree for this mesh from a cached mesh file
      *
-     * @tparam U the Scalar type of the other Mesh object
+     * @param path the path to the cached mesh file
+     * @param key  the key that the mesh file must have been written with
      *
-     * @param b the other Mesh object to convert from
+     * @return true if the mesh was loaded, false if the file does not exist or is not a valid match for this mesh
      */
-    template <typename U>
-    Mesh(const Mesh<U, Model>& b) : h(static_cast<Scalar>(b.h)), max_distance(static_cast<Scalar>(b.max_distance)) {
-        nodes.reserve(b.nodes.size());
-        bsp.reserve(b.bsp.size());
+    bool load(const std::string& path, const uint64_t& key) {
+        using namespace mesh_file;
+        constexpr int N_NEIGHBOURS = Model<Scalar>::N_NEIGHBOURS;
 
-        for (const auto& n : b.nodes) {
-            nodes.push_back(Node<Scalar, Model<Scalar>::N_NEIGHBOURS>{cast<Scalar>(n.ray), n.neighbours});
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) { return false; }
+        const uint64_t size = in.tellg();
+
+        Header header;
+        if (size < sizeof(Header) || !in.seekg(0) || !in.read(reinterpret_cast<char*>(&header), sizeof(Header))) {
+            return false;
         }
-        for (const auto& b : b.bsp) {
-            bsp.push_back(
-              BSP{b.range, b.children, std::make_pair(cast<Scalar>(b.cone.first), cast<Scalar>(b.cone.second))});
+        if (header.magic != MAGIC || header.version != VERSION || header.order_mark != ORDER_MARK
+            || header.scalar_size != sizeof(Scalar) || header.key != key
+            || header.n_neighbours != uint32_t(N_NEIGHBOURS)
+            || header.nodes_offset + uint64_t(header.n_nodes) * sizeof(Node<Scalar, N_NEIGHBOURS>) > size
+            || header.bsp_offset + uint64_t(header.n_bsp) * sizeof(BSPEntry<Scalar>) > size) {
+            return false;
         }
+
+        std::vector<Node<Scalar, N_NEIGHBOURS>> file_nodes(header.n_nodes);
+        std::vector<BSPEntry<Scalar>> entries(header.n_bsp);
+        in.seekg(header.nodes_offset);
+        in.read(reinterpret_cast<char*>(file_nodes.data()), file_nodes.size() * sizeof(Node<Scalar, N_NEIGHBOURS>));
+        in.seekg(header.bsp_offset);
+        in.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(BSPEntry<Scalar>));
+        if (!in) { return false; }
+
+        nodes = std::move(file_nodes);
+        bsp.clear();
+        bsp.reserve(entries.size());
+        for (const auto& e : entries) {
+            bsp.push_back(BSP{std::make_pair(e.range[0], e.range[1]),
+                              e.children,
+                              std::make_pair(vec3<Scalar>{e.axis[0], e.axis[1], e.axis[2]},
+                                             vec2<Scalar>{e.cos_theta, e.sin_theta})});
+        }
+        return true;
     }
 
     /**
-     * @brief Lookup which ranges in the Visual Mesh are on screen given the description of the camera lens/sensor and
-     * the orientation of the camera relative to the observation plane.
+     * @brief Save the nodes and BSP tree for this mesh to a cached mesh file
      *
-     * @param Hoc   the homogenous transformation matrix that transforms from camera space to observation plane space
-     * @param lens  the lens object describing the type and geometry of the lens that is used
+     * @details
+     *  The file is written to a temporary file and then renamed into place, so other processes that are loading the
+     *  same cache will either see the complete file or no file at all. The temporary file is removed if anything fails.
+     *
+     * @param path the path to write the cached mesh file to
+     * @param key  the key to write the mesh file with
+     */
+    void save(const std::string& path, const uint64_t& key) const {
+        using namespace mesh_file;
+        constexpr int N_NEIGHBOURS   = Model<Scalar>::N_NEIGHBOURS;
+        constexpr uint64_t alignment = 64;
+
+        Header header{};
+        header.magic        = MAGIC;
+        header.version      = VERSION;
+        header.order_mark   = ORDER_MARK;
+        header.scalar_size  = sizeof(Scalar);
+        header.key          = key;
+        header.n_neighbours = N_NEIGHBOURS;
+        header.n_nodes      = nodes.size();
+        header.n_bsp        = bsp.size();
+        header.nodes_offset = (sizeof(Header) + alignment - 1) / alignment * alignment;
+        header.bsp_offset   = header.nodes_offset + nodes.size() * sizeof(Node<Scalar, N_NEIGHBOURS>);
+        header.bsp_offset   = (header.bsp_offset + alignment - 1) / alignment * alignment;
+
+        std::vector<BSPEntry<Scalar>> entries;
+        entries.reserve(bsp.size());
+        for (const auto& b : bsp) {
+            entries.push_back(BSPEntry<Scalar>{{b.range.first, b.range.second},
+                                               b.children,
+                                               {b.cone.first[0], b.cone.first[1], b.cone.first[2]},
+                                               b.cone.second[0],
+                                               b.cone.second[1]});
+        }
+
+        const std::string tmp = temporary_path(path);
+        /* file scope */ {
+            std::ofstream out(tmp, std::ios::binary);
+            if (!out) {
+                std::remove(tmp.c_str());
+                throw std::runtime_error("Failed to open " + tmp + " for writing");
+            }
+
+            const std::vector<char> zeros(alignment, 0);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+            out.write(zeros.data(), header.nodes_offset - sizeof(Header));
+            out.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(Node<Scalar, N_NEIGHBOURS>));
+            out.write(zeros.data(), header.bsp_offset - uint64_t(out.tellp()));
+            out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(BSPEntry<Scalar>));
+            if (!out) {
+                std::remove(tmp.c_str());
+                throw std::runtime_error("Failed to write the mesh to " + tmp);
+            }
+        }
+        if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            throw std::runtime_error("Failed to move the mesh into " + path);
+        }
+    }
+
+    /**
+     * @brief Find the ranges of the mesh that are on screen by searching through the BSP tree
+     *
+     * @param Hoc      the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param prepared the prepared lens describing the type and geometry of the lens that is used
+     * @param cache    if not null, results from previous lookups to reuse and a place to store the results of this one
+     * @param segments if not null, filled with the on screen points split by whether they were projected
+     * @param pixels   if segments is not null, filled with the pixel coordinates of the points that were projected
      *
      * @return pairs of start/end ranges that are the points which are on the screen
      */
-    std::vector<std::pair<int, int>> lookup(const mat4<Scalar>& Hoc, const Lens<Scalar>& lens) const {
+    std::vector<std::pair<int, int>> find_ranges(const mat4<Scalar>& Hoc,
+                                                 const PreparedLens<Scalar>& prepared,
+                                                 LookupCache<Scalar>* cache,
+                                                 std::vector<Segment>* segments    = nullptr,
+                                                 std::vector<vec2<Scalar>>* pixels = nullptr) const {
+
+        const Lens<Scalar>& lens = prepared.lens;
 
         // Our FOV is an easy check to exclude things outside our view
-        // Multiply by 0.5 to get the cone angle
-        const Scalar cos_fov = std::cos(lens.fov * Scalar(0.5));
-        const Scalar sin_fov = std::sin(lens.fov * Scalar(0.5));
+        // These are the cos and sin of half the FOV which is the cone angle
+        const Scalar& cos_fov = prepared.cos_fov;
+        const Scalar& sin_fov = prepared.sin_fov;
 
         // Get the x axis of the camera in world space and the cone equations that describe the edges of the screen
         const mat3<Scalar> Rco(block<3, 3>(transpose(Hoc)));
         const vec3<Scalar>& rXCo = Rco[0];  // Camera x in world space
-        const auto edges         = screen_edges(Hoc, lens);
+        const auto edges         = screen_edges(Hoc, prepared);
+
+        // How many pixels a point can move per radian the camera rotates when working out how long results are valid
+        const Scalar pixel_speed = cache != nullptr ? cache->pixel_speed : Scalar(0);
+
+        // Add points to the segments, joining them onto the last segment if it continues on from it in the same way
+        auto add_segment = [&](const int& start, const int& end, const bool& projected) {
+            if (segments == nullptr) { return; }
+            if (!segments->empty() && segments->back().range.second == start
+                && (segments->back().pixels >= 0) == projected) {
+                segments->back().range.second = end;
+            }
+            else {
+                segments->push_back(Segment{{start, end}, projected ? int(pixels->size()) - (end - start) : -1});
+            }
+        };
 
         // Go through our BSP tree to work out which segments of the mesh are on screen
         // The first element of the tree is the root element of the bsp
@@ -525,15 +988,36 @@ public:
             // outside == dot(cam, axis) < cos(fov + acos(gradient))
             // However given that the thetas don't change and we have gradient naturally from the dot product it's
             // easier to calculate it using the compound angle formula
-            const Scalar delta = dot(rXCo, cone.first);
-            bool outside       = delta < cos_fov * cone.second[0] - sin_fov * cone.second[1];
-            bool inside        = delta > cos_fov * cone.second[0] + sin_fov * cone.second[1];
-
-            // The FOV can either entirely exclude our points, or split based on intersection. If it can't do either of
-            // these (entirely inside) we need to use the screen edges to do a proper check.
-            if (!outside && inside) { std::tie(inside, outside) = check_on_screen(Rco, cone, lens, edges); }
+            bool inside;
+            bool outside;
+            if (cache != nullptr && cache->bsp_valid(i)) {
+                inside  = cache->bsp_state[i] == LookupCache<Scalar>::INSIDE;
+                outside = cache->bsp_state[i] == LookupCache<Scalar>::OUTSIDE;
+            }
+            else {
+                const Scalar delta = dot(rXCo, cone.first);
+                const Scalar lower = cos_fov * cone.second[0] - sin_fov * cone.second[1];
+                const Scalar upper = cos_fov * cone.second[0] + sin_fov * cone.second[1];
+                outside            = delta < lower;
+                inside             = delta > upper;
+
+                // The FOV can either entirely exclude our points, or split based on intersection. If it can't do either
+                // of these (entirely inside) we need to use the screen edges to do a proper check.
+                // How far the camera can rotate before the result of these checks could change
+                Scalar slack = std::min(std::abs(delta - lower), std::abs(delta - upper));
+                if (!outside && inside) {
+                    // The screen edge checks only hold while the cone stays inside the field of view
+                    Scalar edge_slack         = 0;
+                    std::tie(inside, outside) = check_on_screen(
+                      Rco, cone, prepared, edges, cache != nullptr ? &edge_slack : nullptr, pixel_speed);
+                    slack = std::min(slack, edge_slack);
+                }
+                if (cache != nullptr) { cache->store_bsp(i, inside, outside, slack); }
+            }
 
             if (inside) {
+                add_segment(elem.range.first, elem.range.second, false);
+
                 // If we are building just update our end point
                 if (building) {
                     range_end = elem.range.second;  //
@@ -552,13 +1036,35 @@ public:
                 }
             }
             // We have reached the end of a tree, from here we need to check each point on screen individually
-            else if (elem.children[0] < 0) {
+            else if (elem.children < 0) {
                 for (int i = elem.range.first; i < elem.range.second; ++i) {
-                    // Check if the pixel is on the screen
-                    auto px              = visualmesh::project(multiply(Rco, nodes[i].ray), lens);
-                    const bool on_screen = dot(rXCo, nodes[i].ray) > cos_fov && 0 <= px[0]
-                                           && px[0] + 1 <= lens.dimensions[0] && 0 <= px[1]
-                                           && px[1] + 1 <= lens.dimensions[1];
+                    bool on_screen;
+                    bool projected = false;
+                    if (cache != nullptr && cache->node_valid(i)) { on_screen = cache->node_state[i]; }
+                    else {
+                        // Check if the pixel is on the screen
+                        const vec3<Scalar> rNCo = ray(i);
+                        auto px                 = visualmesh::project(multiply(Rco, rNCo), prepared);
+                        const Scalar delta      = dot(rXCo, rNCo);
+                        on_screen = delta > cos_fov && 0 <= px[0] && px[0] + 1 <= lens.dimensions[0] && 0 <= px[1]
+                                    && px[1] + 1 <= lens.dimensions[1];
+
+                        // Outside the field of view the pixel coordinates don't matter, inside it they can only move
+                        // as fast as the lens allows
+                        if (cache != nullptr) {
+                            const Scalar slack = delta > cos_fov
+                                                   ? std::min(delta - cos_fov, pixel_margin(px, lens) / pixel_speed)
+                                                   : cos_fov - delta;
+                            cache->store_node(i, on_screen, slack);
+                        }
+
+                        // Keep the pixel so it does not need to be projected again
+                        if (on_screen && segments != nullptr) {
+                            pixels->push_back(px);
+                            projected = true;
+                        }
+                    }
+                    if (on_screen) { add_segment(i, i + 1, projected); }
 
                     if (on_screen && building) {
                         // Extend the end
@@ -580,8 +1086,8 @@ public:
 
             else {
                 // Add the children of this to the search in order 1,0 so we pop 0 first (contiguous indices)
-                stack.push_back(elem.children[1]);
-                stack.push_back(elem.children[0]);
+                stack.push_back(elem.children + 1);
+                stack.push_back(elem.children);
             }
         }
         // If we finished while building add the last point
@@ -590,17 +1096,241 @@ public:
         return ranges;
     }
 
+public:
+    /**
+     * @brief Construct a new Mesh object
+     *
+     * @details
+     *  Constructs a new Mesh object using the provided model type. This mesh object generates a BSP tree and holds the
+     *  logic needed to quickly lookup points that are on screen and return valid index ranges.
+     *
+     *  If a cache directory is provided, the mesh will be loaded from it if it was previously generated with the same
+     *  model, shape and parameters. Otherwise it is generated and saved into the directory for next time. Caching is
+     *  best effort, if the directory is missing or can't be written to then the mesh is generated without being saved.
+     *
+     * @tparam Shape     the type of shape that will be used to generate the Visual Mesh
+     *
+     * @param shape           the shape instance that will be used to generate the Visual Mesh
+     * @param h               the height of the camera above the observation plane
+     * @param k               the number of cross section intersections that are needed for the object
+     * @param max_distance    the maximum distance to generate the Visual Mesh for
+     * @param cache_directory a directory to cache the generated mesh in, or empty to always generate the mesh
+     * @param concurrency     the number of threads to use when generating the mesh
+     */
+    template <typename Shape>
+    Mesh(const Shape& shape,
+         const Scalar& h,
+         const Scalar& k,
+         const Scalar& max_distance,
+         const std::string& cache_directory = "",
+         const unsigned int& concurrency    = std::thread::hardware_concurrency())
+      : h(h), max_distance(max_distance) {
+
+        if (cache_directory.empty()) {
+            build(shape, k, concurrency);
+            return;
+        }
+
+        const uint64_t key = cache_key(shape, h, k, max_distance);
+        std::stringstream path;
+        path << cache_directory << "/mesh_" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+
+        if (!load(path.str(), key)) {
+            build(shape, k, concurrency);
+            try {
+                save(path.str(), key);
+            }
+            catch (const std::exception&) {
+                // The mesh is still usable, it just has to be generated again next time
+            }
+        }
+    }
+
+    /**
+     * @brief Converts a Mesh object of a different Scalar to this Scalar type
+     *
+     * @tparam U the Scalar type of the other Mesh object
+     *
+     * @param b the other Mesh object to convert from
+     */
+    template <typename U>
+    Mesh(const Mesh<U, Model>& b) : h(static_cast<Scalar>(b.h)), max_distance(static_cast<Scalar>(b.max_distance)) {
+        // A compact mesh is kept compact, and its cones have already been widened for the error in its rays
+        if (b.is_compact()) { compact_nodes = CompactNodes<Scalar, Model<Scalar>::N_NEIGHBOURS>(b.compact_nodes); }
+        else {
+            nodes.reserve(b.nodes.size());
+            for (const auto& n : b.nodes) {
+                nodes.push_back(Node<Scalar, Model<Scalar>::N_NEIGHBOURS>{cast<Scalar>(n.ray), n.neighbours});
+            }
+        }
+
+        bsp.reserve(b.bsp.size());
+        for (const auto& b : b.bsp) {
+            bsp.push_back(
+              BSP{b.range, b.children, std::make_pair(cast<Scalar>(b.cone.first), cast<Scalar>(b.cone.second))});
+        }
+    }
+
+    /**
+     * @brief Lookup which ranges in the Visual Mesh are on screen given the description of the camera lens/sensor and
+     * the orientation of the camera relative to the observation plane.
+     *
+     * @param Hoc   the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens  the lens describing the type and geometry of the lens that is used, which can be prepared ahead of
+     *              time to avoid recalculating what it needs
+     *
+     * @return pairs of start/end ranges that are the points which are on the screen
+     */
+    std::vector<std::pair<int, int>> lookup(const mat4<Scalar>& Hoc, const PreparedLens<Scalar>& lens) const {
+        return find_ranges(Hoc, lens, nullptr);
+    }
+
+    /**
+     * @brief Lookup which ranges in the Visual Mesh are on screen reusing the results from previous lookups
+     *
+     * @details
+     *  The ranges are identical to those from the uncached lookup, however only the parts of the mesh that the screen
+     *  edges may have moved over since the previous lookup with this cache are retested. This makes looking up a
+     *  sequence of frames from a camera that moves smoothly much faster.
+     *
+     * @param Hoc   the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens  the lens describing the type and geometry of the lens that is used, which can be prepared ahead of
+     *              time to avoid recalculating what it needs
+     * @param cache the results of previous lookups, which will be updated with the results of this one
+     *
+     * @return pairs of start/end ranges that are the points which are on the screen
+     */
+    std::vector<std::pair<int, int>> lookup(const mat4<Scalar>& Hoc,
+                                            const PreparedLens<Scalar>& lens,
+                                            LookupCache<Scalar>& cache) const {
+        cache.update(uid, size(), bsp.size(), block<3, 3>(transpose(Hoc)), lens.lens);
+        return find_ranges(Hoc, lens, &cache);
+    }
+
+    /**
+     * @brief Lookup which ranges in the Visual Mesh are on screen, also returning the pixel coordinates of the points
+     *        that the lookup had to project to find out if they were on the screen
+     *
+     * @details
+     *  Points inside BSP elements that are entirely on the screen, and points whose result came from the cache, are
+     *  never projected by the lookup. The segments say which points these are so that only they need to be projected
+     *  afterwards, and every point that is on screen is projected exactly once. The segments cover the same points in
+     *  the same order as the ranges from the other lookups.
+     *
+     * @param Hoc    the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens   the lens describing the type and geometry of the lens that is used, which can be prepared ahead of
+     *               time to avoid recalculating what it needs
+     * @param cache  the results of previous lookups, which will be updated with the results of this one
+     * @param pixels filled with the pixel coordinates of the points in the segments that have them
+     *
+     * @return the segments of the mesh that are on screen
+     */
+    std::vector<Segment> lookup(const mat4<Scalar>& Hoc,
+                                const PreparedLens<Scalar>& lens,
+                                LookupCache<Scalar>& cache,
+                                std::vector<vec2<Scalar>>& pixels) const {
+        cache.update(uid, size(), bsp.size(), block<3, 3>(transpose(Hoc)), lens.lens);
+        std::vector<Segment> segments;
+        pixels.clear();
+        find_ranges(Hoc, lens, &cache, &segments, &pixels);
+        return segments;
+    }
+
+    /**
+     * @brief Lookup which ranges in the Visual Mesh are on screen without a cache, also returning the pixel coordinates
+     *        of the points that the lookup had to project, see the cached overload
+     *
+     * @param Hoc    the homogenous transformation matrix that transforms from camera space to observation plane space
+     * @param lens   the lens describing the type and geometry of the lens that is used, which can be prepared ahead of
+     *               time to avoid recalculating what it needs
+     * @param pixels filled with the pixel coordinates of the points in the segments that have them
+     *
+     * @return the segments of the mesh that are on screen
+     */
+    std::vector<Segment> lookup(const mat4<Scalar>& Hoc,
+                                const PreparedLens<Scalar>& lens,
+                                std::vector<vec2<Scalar>>& pixels) const {
+        std::vector<Segment> segments;
+        pixels.clear();
+        find_ranges(Hoc, lens, nullptr, &segments, &pixels);
+        return segments;
+    }
+
+    /**
+     * @brief Store the nodes of this mesh in a compact form that is decoded as they are accessed
+     *
+     * @details
+     *  This more than halves the memory used by the nodes (see CompactNodes), at the cost of moving each ray by up to
+     *  around 4e-5 radians and decoding the nodes as lookups and engines access them. The cones of the BSP are widened
+     *  by the largest error in the rays so that a lookup still finds every point that is on screen. Once a mesh is
+     *  compact the nodes vector is empty, so the nodes must be accessed through size, ray and neighbours.
+     */
+    void compact() {
+        if (is_compact()) { return; }
+
+        compact_nodes = CompactNodes<Scalar, Model<Scalar>::N_NEIGHBOURS>(nodes);
+        std::vector<Node<Scalar, Model<Scalar>::N_NEIGHBOURS>>().swap(nodes);
+
+        // Grow the angle of every cone by the error, limiting it to a cone that covers the whole sphere
+        const Scalar cos_e = std::cos(compact_nodes.error());
+        const Scalar sin_e = std::sin(compact_nodes.error());
+        for (auto& b : bsp) {
+            const Scalar c = b.cone.second[0];
+            const Scalar s = b.cone.second[1];
+            b.cone.second  = s * cos_e + c * sin_e > 0 ? vec2<Scalar>{c * cos_e - s * sin_e, s * cos_e + c * sin_e}
+                                                       : vec2<Scalar>{-1, 0};
+        }
+
+        // The rays have moved so any cached lookups for this mesh are no longer valid
+        uid = detail::next_mesh_id();
+    }
+
+    /// If the nodes of this mesh are stored in compact form
+    bool is_compact() const {
+        return !compact_nodes.empty();
+    }
+
+    /// The number of nodes in the mesh, which is also the index that neighbours not in the mesh point to
+    std::size_t size() const {
+        return is_compact() ? compact_nodes.size() : nodes.size();
+    }
+
+    /// The unit vector for a node, decoding it if the mesh is compact
+    vec3<Scalar> ray(const int& i) const {
+        return is_compact() ? compact_nodes.ray(i) : nodes[i].ray;
+    }
+
+    /// The absolute indices of the neighbours of a node, decoding them if the mesh is compact
+    std::array<int, Model<Scalar>::N_NEIGHBOURS> neighbours(const int& i) const {
+        return is_compact() ? compact_nodes.neighbours(i) : nodes[i].neighbours;
+    }
+
+    /// The number of bytes used to store the nodes and BSP tree of this mesh
+    std::size_t bytes() const {
+        return nodes.size() * sizeof(Node<Scalar, Model<Scalar>::N_NEIGHBOURS>) + compact_nodes.bytes()
+               + bsp.size() * sizeof(BSP);
+    }
+
+    /// An id that is unique to this mesh and its contents among all the meshes created in this process
+    uint64_t id() const {
+        return uid;
+    }
+
 public:
     /// The height that this mesh is designed to run at
     Scalar h;
     /// The maximum distance this mesh is setup for
     Scalar max_distance;
-    /// The lookup table for this mesh
+    /// The lookup table for this mesh, which is empty if the mesh is compact
     std::vector<Node<Scalar, Model<Scalar>::N_NEIGHBOURS>> nodes;
 
 private:
+    /// The nodes of this mesh if it is compact
+    CompactNodes<Scalar, Model<Scalar>::N_NEIGHBOURS> compact_nodes;
     /// The binary search tree that is used for looking up which points are on screen in the mesh
     std::vector<BSP> bsp;
+    /// An id that identifies this mesh's contents to a LookupCache
+    uint64_t uid = detail::next_mesh_id();
 
     template <typename S, template <typename> class M>
     friend class Mesh;
@@ -19,12 +19,16 @@
 #define VISUALMESH_MODEL_GRID_BASE_HPP
 
 #include <array>
-#include <map>
-#include <set>
-#include <stack>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
 #include <vector>
 
+#include "map_batch.hpp"
 #include "visualmesh/node.hpp"
+#include "visualmesh/utility/math.hpp"
+#include "visualmesh/utility/thread_pool.hpp"
 
 namespace visualmesh {
 namespace model {
@@ -72,74 +76,193 @@ namespace model {
       vec2<I>{{-1, -1}},  // Bottom Left
     }};
 
+    /**
+     * @brief An open addressing hash table from coordinates on a grid to an index
+     *
+     * @details
+     *  This is used in place of a std::set when flood filling a grid, it stores its entries in a single flat array so
+     *  that adding a coordinate does not need to allocate or follow pointers.
+     */
+    class GridIndex {
+    public:
+        GridIndex() : slots(1024, Slot{vec2<int>{{0, 0}}, EMPTY}) {}
+
+        /**
+         * @brief Add a coordinate with a value if it is not already in the table
+         *
+         * @return a pointer to the value that is stored for the coordinate, and if it was added
+         */
+        std::pair<int*, bool> emplace(const vec2<int>& key, const int& value) {
+            // Grow the table when it is half full to keep the probe sequences short
+            if ((count + 1) * 2 > slots.size()) { grow(); }
+
+            Slot& slot = slots[probe(key)];
+            if (slot.value != EMPTY) { return std::make_pair(&slot.value, false); }
+            slot = Slot{key, value};
+            ++count;
+            return std::make_pair(&slot.value, true);
+        }
+
+    private:
+        /// The value that marks a slot as empty
+        static constexpr int EMPTY = std::numeric_limits<int>::min();
+
+        struct Slot {
+            vec2<int> key;
+            int value;
+        };
+
+        /// Find the slot that holds a coordinate, or the empty slot where it would go
+        std::size_t probe(const vec2<int>& key) const {
+            const uint64_t bits    = uint64_t(uint32_t(key[0])) << 32 | uint32_t(key[1]);
+            const std::size_t mask = slots.size() - 1;
+            for (std::size_t i = (bits * 0x9E3779B97F4A7C15ULL) >> 32 & mask;; i = (i + 1) & mask) {
+                if (slots[i].value == EMPTY || slots[i].key == key) { return i; }
+            }
+        }
+
+        /// Double the size of the table and put every entry back into it
+        void grow() {
+            std::vector<Slot> old(slots.size() * 2, Slot{vec2<int>{{0, 0}}, EMPTY});
+            std::swap(old, slots);
+            for (const auto& slot : old) {
+                if (slot.value != EMPTY) { slots[probe(slot.key)] = slot; }
+            }
+        }
+
+        /// The slots of the table, the number of which is always a power of two
+        std::vector<Slot> slots;
+        /// The number of slots that are in use
+        std::size_t count = 0;
+    };
+
     template <typename Scalar, template <typename> class Map, int N_NEIGHBOURS>
     struct GridBase : public Map<Scalar> {
+    private:
+        /**
+         * @brief Work out the nm coordinates for a point on the grid
+         */
+        static vec2<Scalar> nm(const vec2<int>& e, const Scalar& jump) {
+            // 6 Neighbours are using hexagonal axial coordinates so need special calculations
+            return N_NEIGHBOURS == 6
+                     ? multiply(vec2<Scalar>{{e[0] + Scalar(0.5) * e[1], std::sqrt(Scalar(3)) * Scalar(0.5) * e[1]}},
+                                jump)
+                     : multiply(cast<Scalar>(e), jump);
+        }
+
     public:
+        /**
+         * @brief Generates the visual mesh vectors and graph for a grid
+         *
+         * @details
+         *  The mesh is found by flood filling the grid out from the origin until it goes past the max distance. Rather
+         *  than visiting one point at a time, the fill advances a whole front of points at once so the points in each
+         *  front can be mapped in parallel. Each point that is seen is numbered using a hash table, and the numbers of
+         *  the neighbours of each point are kept so that the nodes can then be put in the order that a depth first
+         *  flood fill would visit them. This means the mesh is exactly the same as it has always been.
+         *
+         * @tparam Shape  the type of shape that this model will use to create the mesh
+         *
+         * @param shape         the shape instance that is used for calculating details
+         * @param h             the height of the camera above the observation plane
+         * @param k             the number of intersections per object
+         * @param max_distance  the maximum distance that this mesh will be targeted for
+         * @param pool          the thread pool to map the points with
+         *
+         * @return the visual mesh graph that was generated
+         */
         template <typename Shape>
         static std::vector<Node<Scalar, N_NEIGHBOURS>> generate(const Shape& shape,
                                                                 const Scalar& h,
                                                                 const Scalar& k,
-                                                                const Scalar& max_distance) {
+                                                                const Scalar& max_distance,
+                                                                util::ThreadPool& pool) {
+            static_assert(N_NEIGHBOURS == 4 || N_NEIGHBOURS == 6 || N_NEIGHBOURS == 8,
+                          "You must choose 4, 6 or 8 neighbours");
 
             // Our jumps are based on if we are hexagonal or a quad base
             const Scalar jump = 1.0 / k;
 
-            // Hold the final nodes, as well as a map to create the link locations
-            std::vector<Node<Scalar, N_NEIGHBOURS>> output;
-            std::map<vec2<int>, int> locations;
+            // Number each point as it is seen, and keep its coordinates, its ray, if it is within the max distance and
+            // the numbers of its neighbours if it is
+            GridIndex seen;
+            std::vector<vec2<int>> coordinates = {vec2<int>{{0, 0}}};
+            std::vector<vec3<Scalar>> rays;
+            std::vector<char> valid;
+            std::vector<std::array<int, N_NEIGHBOURS>> links;
+            seen.emplace(coordinates.front(), 0);
 
-            // Perform a flood fill to find all the points that are on the screen
-            std::set<vec2<int>> seen;
-            std::stack<vec2<int>> stack;
-            seen.insert(vec2<int>{{0, 0}});
-            stack.push(vec2<int>{{0, 0}});
-            while (!stack.empty()) {
-                // Get the next point to inspect on the stack
-                auto e = stack.top();
-                stack.pop();
-
-                // 6 Neighbours are using hexagonal axial coordinates so need special calculations
-                vec2<Scalar> nm =
-                  N_NEIGHBOURS == 6 ? multiply(
-                    vec2<Scalar>{{e[0] + Scalar(0.5) * e[1], std::sqrt(Scalar(3)) * Scalar(0.5) * e[1]}}, jump)
-                                    : multiply(cast<Scalar>(e), jump);
-                static_assert(N_NEIGHBOURS == 4 || N_NEIGHBOURS == 6 || N_NEIGHBOURS == 8,
-                              "You must choose 4, 6 or 8 neighbours");
-
-                // Map the point using our mapping function
-                vec3<Scalar> vec = Map<Scalar>::map(shape, h, nm);
-                Scalar distance  = norm(head<2>(vec));
-
-                // We only work with this point if we didn't exceed our max distance
-                if (distance <= max_distance) {
-                    // Add the element to the output and store where this coordinate ended up so we can find it later
-                    Node<Scalar, N_NEIGHBOURS> node;
-                    node.ray = normalise(vec);
-                    locations.emplace(e, output.size());
-                    output.push_back(node);
-
-                    // Add in each of our neighbours to be checked
-                    for (const auto& o : GridOffsets<N_NEIGHBOURS, int>::offsets) {
-                        vec2<int> n = add(e, o);
-                        if (seen.count(n) == 0) {
-                            seen.insert(n);
-                            stack.push(n);
+            // Perform a flood fill to find all the points that are on the screen, mapping each front at once
+            for (unsigned int front = 0; front < coordinates.size();) {
+                const unsigned int end = coordinates.size();
+                rays.resize(end);
+                valid.resize(end);
+                links.resize(end);
+                pool.parallel_for(front, end, 0, [&](const int& start, const int& end) {
+                    std::vector<vec2<Scalar>> points;
+                    points.reserve(end - start);
+                    for (int i = start; i < end; ++i) {
+                        points.push_back(nm(coordinates[i], jump));
+                    }
+
+                    // Map the points using our mapping function
+                    map_batch<Map<Scalar>>(shape, h, points.data(), end - start, &rays[start]);
+
+                    // We only work with the points that didn't exceed our max distance
+                    for (int i = start; i < end; ++i) {
+                        valid[i] = norm(head<2>(rays[i])) <= max_distance;
+                        rays[i]  = normalise(rays[i]);
+                    }
+                });
+
+                // Add in the neighbours of the points that are on the mesh to be checked next
+                for (; front < end; ++front) {
+                    if (valid[front]) {
+                        for (int j = 0; j < N_NEIGHBOURS; ++j) {
+                            const vec2<int> n = add(coordinates[front], GridOffsets<N_NEIGHBOURS, int>::offsets[j]);
+                            const auto added  = seen.emplace(n, coordinates.size());
+                            if (added.second) { coordinates.push_back(n); }
+                            links[front][j] = *added.first;
                         }
                     }
                 }
             }
 
-            // Set all the neighbours using the map
-            for (const auto& loc : locations) {
-                const vec2<int>& coord           = loc.first;
-                Node<Scalar, N_NEIGHBOURS>& node = output[loc.second];
+            // Visit the points in the order a depth first flood fill would to find where each node goes in the output
+            std::vector<int> order;
+            std::vector<int> index(coordinates.size(), -1);
+            std::vector<char> visited(coordinates.size(), 0);
+            std::vector<int> stack = {0};
+            visited[0]             = 1;
+            while (!stack.empty()) {
+                const int p = stack.back();
+                stack.pop_back();
 
-                for (int i = 0; i < N_NEIGHBOURS; ++i) {
-                    vec2<int> target   = add(coord, GridOffsets<N_NEIGHBOURS, int>::offsets[i]);
-                    node.neighbours[i] = locations.count(target) > 0 ? locations.find(target)->second : output.size();
+                if (valid[p]) {
+                    index[p] = order.size();
+                    order.push_back(p);
+                    for (const auto& n : links[p]) {
+                        if (!visited[n]) {
+                            visited[n] = 1;
+                            stack.push_back(n);
+                        }
+                    }
                 }
             }
 
+            // Set all the rays and neighbours, pointing the neighbours that are not on the mesh to the off screen node
+            std::vector<Node<Scalar, N_NEIGHBOURS>> output(order.size());
+            pool.parallel_for(0, output.size(), 0, [&](const int& start, const int& end) {
+                for (int i = start; i < end; ++i) {
+                    const int p   = order[i];
+                    output[i].ray = rays[p];
+                    for (int j = 0; j < N_NEIGHBOURS; ++j) {
+                        const int n             = links[p][j];
+                        output[i].neighbours[j] = index[n] < 0 ? int(output.size()) : index[n];
+                    }
+                }
+            });
+
             return output;
         }
 
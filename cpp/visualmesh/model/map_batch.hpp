@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_MODEL_MAP_BATCH_HPP
+#define VISUALMESH_MODEL_MAP_BATCH_HPP
+
+#include "visualmesh/utility/math.hpp"
+
+namespace visualmesh {
+namespace model {
+
+    /**
+     * @brief Takes many points in n, m space and converts each of them into a vector to the centre of the object using
+     * the map of a model
+     *
+     * @details
+     *  This is the one place that mesh generation and the MapVisualMesh op map lists of points, so a model that can
+     *  solve many points faster together only needs to change this. Each point is currently solved on its own so the
+     *  result for a point does not depend on the other points it is mapped with, which keeps generated meshes the same
+     *  however their points are split between threads.
+     *
+     * @tparam Map    the model or map class whose single point map is used
+     * @tparam Shape  the type of the shape object
+     * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+     *
+     * @param shape   the shape object used to calculate the angles
+     * @param h       the height of the camera above the observation plane
+     * @param nm      the coordinates of each point in the nm space (object space)
+     * @param count   the number of points to map
+     * @param vectors where to write the vector <x, y, z> for each of the points
+     */
+    template <typename Map, typename Shape, typename Scalar>
+    void map_batch(const Shape& shape,
+                   const Scalar& h,
+                   const vec2<Scalar>* nm,
+                   const int& count,
+                   vec3<Scalar>* vectors) {
+        for (int i = 0; i < count; ++i) {
+            vectors[i] = Map::map(shape, h, nm[i]);
+        }
+    }
+
+}  // namespace model
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_MODEL_MAP_BATCH_HPP
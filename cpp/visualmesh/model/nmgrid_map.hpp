@@ -18,6 +18,9 @@
 #ifndef VISUALMESH_MODEL_NMGRID_MAP_HPP
 #define VISUALMESH_MODEL_NMGRID_MAP_HPP
 
+#include <cmath>
+#include <limits>
+
 #include "visualmesh/utility/math.hpp"
 
 namespace visualmesh {
@@ -61,42 +64,11 @@ namespace model {
             return shape.n(phi_m, h_m);
         }
 
-    public:
         /**
-         * @brief Takes a point in n, m space (jumps along x and jumps along y) and converts it into a vector to the
-         * centre of the object using the x grid method
-         *
-         * @details
-         * How this works is by optimising the solution until we find one that matches. We do this by optimising the
-         * "height" that the plane must be for the first coordinate to give the correct value for the second
-         * coordinate.
-         *
-         * We set the bounds for the optimisation by noting that if the second coordinate were 0, then the height
-         * value for the first coordinate must be the height of the camera. We then note that as our second coordinate
-         * increases, the height of the first coordinates plane must increase as it must be further away. The furthest
-         * we could possibly be away however, is if the first coordinate were 0, and then we could calculate the
-         * height using the phi equation on the second of the nm pair. This gives us an upper and lower bound for what
-         * the height could be for the first coordinate.
-         *
-         * Having the height value for the first coordinate implicitly gives us a y coordinate on our ground plane and
-         * using the phi equation we can calculate an x value on the ground plane too.
-         * From this x value we can calculate a height for the second axis. Then using the y value on the ground we
-         * can calculate a phi value along this orthogonal direction plane. We can feed this into the shape.n function
-         * to calculate what the second coordinate would be given the provided angle. This can be compared to the true
-         * m value and if it is low or high we can adjust the height to find the actual height for the first equation
-         * that gives the appropriate value for the second equation.
-         *
-         * @param shape the shape object used to calculate the angles
-         * @param h     the height of the camera above the observation plane
-         * @param nm    the coordinates in the nm space (object space)
-         *
-         * @return a vector <x, y, z> that points to the centre of the object at these coordinates
+         * @brief Find the height of the plane for the first coordinate by bisection, which is slow but always works
          */
         template <typename Shape>
-        static vec3<Scalar> map(const Shape& shape, const Scalar& h, const vec2<Scalar>& nm) {
-            // Abs first so we don't need to worry about quadrant, we will fix the signs at the end
-            const Scalar& n = std::abs(nm[0]);
-            const Scalar& m = std::abs(nm[1]);
+        static Scalar bisect(const Shape& shape, const Scalar& h, const Scalar& n, const Scalar& m) {
             const Scalar& c = shape.c();
 
             // Set our bounds for the search
@@ -122,8 +94,81 @@ namespace model {
                 h_n = (lo + hi) * 0.5;
             }
 
-            // Make the vector and flip the vectors to point to the correct directions
-            vec3<Scalar> vec = xyz(shape, h, n, h_n);
+            return h_n;
+        }
+
+        /// The most secant steps to take before giving up and using bisection instead
+        static constexpr int MAX_ITERATIONS = 64;
+
+    public:
+        /**
+         * @brief Takes a point in n, m space (jumps along x and jumps along y) and converts it into a vector to the
+         * centre of the object using the x grid method
+         *
+         * @details
+         * The x coordinate on the ground depends on the y coordinate, as it is found by jumping n objects along the
+         * plane that passes through the camera and the line at that y. In the same way the y coordinate depends on the
+         * x coordinate, so the point is where these two agree. Starting with a guess for y we can work out x from it,
+         * and then work out a new y from that x. Where this new y is the same as the guess we have found the point.
+         *
+         * This is solved using the secant method, starting from the y the point would have if x were 0. This usually
+         * takes around five steps to reach full precision. If it does not converge the height of the plane for the
+         * first coordinate is instead found by bisection, which is much slower. We set the bounds for the bisection by
+         * noting that if the second coordinate were 0, then the height value for the first coordinate must be the
+         * height of the camera. The furthest we could possibly be away however, is if the first coordinate were 0, and
+         * then we could calculate the height using the phi equation on the second of the nm pair.
+         *
+         * @param shape the shape object used to calculate the angles
+         * @param h     the height of the camera above the observation plane
+         * @param nm    the coordinates in the nm space (object space)
+         *
+         * @return a vector <x, y, z> that points to the centre of the object at these coordinates
+         */
+        template <typename Shape>
+        static vec3<Scalar> map(const Shape& shape, const Scalar& h, const vec2<Scalar>& nm) {
+            // Abs first so we don't need to worry about quadrant, we will fix the signs at the end
+            const Scalar n  = std::abs(nm[0]);
+            const Scalar m  = std::abs(nm[1]);
+            const Scalar& c = shape.c();
+            const Scalar d  = h - c;
+
+            // Work out x from a guess for y, and then the y that this x gives
+            const auto x_from_y = [&](const Scalar& y) {
+                const Scalar d_n = std::sqrt(y * y + d * d);
+                return d_n * std::tan(shape.phi(n, d_n + c));
+            };
+            const auto y_from_x = [&](const Scalar& x) {
+                const Scalar d_m = std::sqrt(x * x + d * d);
+                return d_m * std::tan(shape.phi(m, d_m + c));
+            };
+
+            // Find where the y we get back is the same as the guess using the secant method
+            Scalar y_p       = d * std::tan(shape.phi(m, h));
+            Scalar g_p       = y_from_x(x_from_y(y_p)) - y_p;
+            Scalar y         = y_p + g_p;
+            bool converged   = g_p == 0;
+            const Scalar tol = 4 * std::numeric_limits<Scalar>::epsilon();
+            for (int i = 0; !converged && i < MAX_ITERATIONS; ++i) {
+                const Scalar g = y_from_x(x_from_y(y)) - y;
+                if (g == g_p) {
+                    converged = true;
+                    break;
+                }
+
+                const Scalar step = g * (y - y_p) / (g - g_p);
+                y_p               = y;
+                g_p               = g;
+                y -= step;
+                converged = !(std::abs(step) > tol * std::abs(y));
+            }
+
+            vec3<Scalar> vec;
+            if (converged && std::isfinite(y)) { vec = vec3<Scalar>{{x_from_y(y), y, c - h}}; }
+            else {
+                vec = xyz(shape, h, n, bisect(shape, h, n, m));
+            }
+
+            // Flip the vectors to point to the correct directions
             vec[0] *= nm[0] >= 0 ? 1 : -1;
             vec[1] *= nm[1] >= 0 ? 1 : -1;
 
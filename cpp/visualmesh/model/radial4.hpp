@@ -25,6 +25,7 @@
 
 #include "polar_map.hpp"
 #include "visualmesh/node.hpp"
+#include "visualmesh/utility/thread_pool.hpp"
 
 namespace visualmesh {
 namespace model {
@@ -43,7 +44,8 @@ namespace model {
         static std::vector<Node<Scalar, N_NEIGHBOURS>> generate(const Shape& shape,
                                                                 const Scalar& h,
                                                                 const Scalar& k,
-                                                                const Scalar& max_distance) {
+                                                                const Scalar& max_distance,
+                                                                util::ThreadPool& /*pool*/) {
             std::vector<Node<Scalar, N_NEIGHBOURS>> nodes;
             // Allows adjustment of starting offset in theta for each ring
             std::vector<Scalar> Theta_Offset;
@@ -23,6 +23,7 @@
 
 #include "polar_map.hpp"
 #include "visualmesh/node.hpp"
+#include "visualmesh/utility/thread_pool.hpp"
 
 namespace visualmesh {
 namespace model {
@@ -41,7 +42,8 @@ namespace model {
         static std::vector<Node<Scalar, N_NEIGHBOURS>> generate(const Shape& shape,
                                                                 const Scalar& h,
                                                                 const Scalar& k,
-                                                                const Scalar& max_distance) {
+                                                                const Scalar& max_distance,
+                                                                util::ThreadPool& /*pool*/) {
             std::vector<Node<Scalar, N_NEIGHBOURS>> nodes;
             // Stores the number of points in each ring
             std::vector<int> number_points;
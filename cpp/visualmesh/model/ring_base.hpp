@@ -25,6 +25,7 @@
 #include "polar_map.hpp"
 #include "visualmesh/node.hpp"
 #include "visualmesh/utility/math.hpp"
+#include "visualmesh/utility/thread_pool.hpp"
 
 namespace visualmesh {
 namespace model {
@@ -47,6 +48,7 @@ namespace model {
          * @param h             the height of the camera above the observation plane
          * @param k             the number of radial intersections per object
          * @param max_distance  the maximum distance that this mesh will be targeted for
+         * @param pool          the thread pool to generate with, which is not needed for rings
          *
          * @return the visual mesh graph that was generated
          */
@@ -54,7 +56,8 @@ namespace model {
         static std::vector<Node<Scalar, N_NEIGHBOURS>> generate(const Shape& shape,
                                                                 const Scalar& h,
                                                                 const Scalar& k,
-                                                                const Scalar& max_distance) {
+                                                                const Scalar& max_distance,
+                                                                util::ThreadPool& /*pool*/) {
 
             std::vector<Node<Scalar, N_NEIGHBOURS>> nodes;
             const Scalar jump = 1.0 / k;
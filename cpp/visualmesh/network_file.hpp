@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_NETWORK_FILE_HPP
+#define VISUALMESH_NETWORK_FILE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "network_structure.hpp"
+#include "utility/fourcc.hpp"
+#include "utility/mapped_file.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief The layout of a binary network file
+ *
+ * @details
+ *  All values are stored in the byte order of the machine that wrote the file, which is checked when it is loaded.
+ *  The file starts with a Header, followed by one uint32_t for each convolutional group holding the number of layers
+ *  in that group, then a LayerHeader for every layer in order. The weights and biases for each layer are stored at the
+ *  offsets given in its LayerHeader, which are measured from the start of the file and aligned to
+ *  PackedWeights::alignment bytes. The weights are stored row major as [input][output] with `stride` values between
+ *  each row.
+ */
+namespace network_file {
+
+    /// The magic number at the start of every network file
+    constexpr uint32_t MAGIC = fourcc("VMNN");
+    /// The current version of the file format
+    constexpr uint32_t VERSION = 1;
+    /// Written as a single value so a file with a different byte order can be detected
+    constexpr uint32_t ORDER_MARK = 0x01020304;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t byte_order;
+        /// The number of bytes in each scalar, 4 for float and 8 for double
+        uint32_t scalar_size;
+        /// The number of convolutional groups in the network
+        uint32_t n_groups;
+        /// The total number of layers in all the groups
+        uint32_t n_layers;
+    };
+
+    struct LayerHeader {
+        /// The ActivationFunction for this layer
+        uint32_t activation;
+        /// The number of inputs (rows of the weights matrix)
+        uint32_t rows;
+        /// The number of outputs (columns of the weights matrix, and number of biases)
+        uint32_t cols;
+        /// The number of values between the start of each row of weights
+        uint32_t stride;
+        /// Offset from the start of the file to the weights
+        uint64_t weights_offset;
+        /// Offset from the start of the file to the biases
+        uint64_t biases_offset;
+    };
+
+    /// Read a trivially copyable value from a mapped file, checking that it is in bounds
+    template <typename T>
+    T read(const util::MappedFile& file, const uint64_t& offset) {
+        if (offset > file.size() || sizeof(T) > file.size() - offset) {
+            throw std::runtime_error("The network file is truncated");
+        }
+        T value;
+        std::memcpy(&value, static_cast<const char*>(file.data()) + offset, sizeof(T));
+        return value;
+    }
+
+    /// Read `n` values stored as FileScalar from a mapped file converting them to Scalar
+    template <typename FileScalar, typename Scalar>
+    std::vector<Scalar> read_values(const util::MappedFile& file, const uint64_t& offset, const std::size_t& n) {
+        // Compare by division so that an offset or count from a corrupt header can't overflow past the check
+        if (offset > file.size() || n > (file.size() - offset) / sizeof(FileScalar)) {
+            throw std::runtime_error("The network file is truncated");
+        }
+        std::vector<FileScalar> values(n);
+        std::memcpy(values.data(), static_cast<const char*>(file.data()) + offset, n * sizeof(FileScalar));
+        return std::vector<Scalar>(values.begin(), values.end());
+    }
+
+    /// Read a layer's weights converting them to Scalar and packing them
+    template <typename FileScalar, typename Scalar>
+    PackedWeights<Scalar> read_weights(const util::MappedFile& file, const LayerHeader& layer) {
+        const auto values =
+          read_values<FileScalar, Scalar>(file, layer.weights_offset, uint64_t(layer.rows) * layer.stride);
+        Weights<Scalar> weights(layer.rows);
+        for (uint32_t i = 0; i < layer.rows; ++i) {
+            const auto row = values.begin() + uint64_t(i) * layer.stride;
+            weights[i].assign(row, row + layer.cols);
+        }
+        return PackedWeights<Scalar>(weights);
+    }
+
+    /// Write zero bytes until the stream is positioned at a multiple of `alignment`
+    inline void pad(std::ofstream& out, const std::size_t& alignment) {
+        const std::size_t n = (alignment - uint64_t(out.tellp()) % alignment) % alignment;
+        const std::vector<char> zeros(n, 0);
+        out.write(zeros.data(), n);
+    }
+
+}  // namespace network_file
+
+/**
+ * @brief Load a network from a binary network file
+ *
+ * @details
+ *  The file is memory mapped and if it was written with the same scalar type the weights of each layer point directly
+ *  into the mapping, which stays mapped for as long as any of the weights are alive. If it was written with a different
+ *  scalar type the weights are converted and copied.
+ *
+ * @tparam Scalar the scalar type to load the network as
+ *
+ * @param path the path to the network file
+ *
+ * @return the network that was stored in the file
+ */
+template <typename Scalar>
+NetworkStructure<Scalar> load_network(const std::string& path) {
+    using namespace network_file;
+
+    auto file = std::make_shared<util::MappedFile>(path);
+
+    const auto header = read<Header>(*file, 0);
+    if (header.magic != MAGIC) { throw std::runtime_error(path + " is not a visual mesh network file"); }
+    if (header.version != VERSION) {
+        throw std::runtime_error(path + " has unsupported network file version " + std::to_string(header.version));
+    }
+    if (header.byte_order != ORDER_MARK) {
+        throw std::runtime_error(path + " was written with a different byte order");
+    }
+    if (header.scalar_size != sizeof(float) && header.scalar_size != sizeof(double)) {
+        throw std::runtime_error(path + " has an unsupported scalar size " + std::to_string(header.scalar_size));
+    }
+
+    // Whether we can point our weights straight at the file
+    const bool zero_copy = std::is_floating_point<Scalar>::value && header.scalar_size == sizeof(Scalar);
+
+    uint64_t offset = sizeof(Header);
+    uint64_t layers = offset + header.n_groups * sizeof(uint32_t);
+    if (layers + header.n_layers * sizeof(LayerHeader) > file->size()) {
+        throw std::runtime_error("The network file is truncated");
+    }
+    NetworkStructure<Scalar> network(header.n_groups);
+    for (auto& conv : network) {
+        const auto n_layers = read<uint32_t>(*file, offset);
+        offset += sizeof(uint32_t);
+
+        for (uint32_t i = 0; i < n_layers; ++i) {
+            const auto l = read<LayerHeader>(*file, layers);
+            layers += sizeof(LayerHeader);
+
+            if (l.activation > TANH) { throw std::runtime_error(path + " has an unknown activation function"); }
+            if (l.stride < l.cols) { throw std::runtime_error(path + " has a layer with an invalid stride"); }
+
+            Layer<Scalar> layer;
+            layer.activation = ActivationFunction(l.activation);
+            if (zero_copy && l.weights_offset % alignof(Scalar) == 0) {
+                if (l.weights_offset > file->size()
+                    || uint64_t(l.rows) * l.stride > (file->size() - l.weights_offset) / sizeof(Scalar)) {
+                    throw std::runtime_error("The network file is truncated");
+                }
+                // The weights share ownership of the mapping so it stays alive as long as they do
+                const char* bytes = static_cast<const char*>(file->data()) + l.weights_offset;
+                std::shared_ptr<const Scalar> values(file, reinterpret_cast<const Scalar*>(bytes));
+                layer.packed_weights = PackedWeights<Scalar>(values, l.rows, l.cols, l.stride);
+            }
+            else if (header.scalar_size == sizeof(float)) {
+                layer.packed_weights = read_weights<float, Scalar>(*file, l);
+            }
+            else {
+                layer.packed_weights = read_weights<double, Scalar>(*file, l);
+            }
+
+            layer.biases = header.scalar_size == sizeof(float)
+                             ? read_values<float, Scalar>(*file, l.biases_offset, l.cols)
+                             : read_values<double, Scalar>(*file, l.biases_offset, l.cols);
+
+            conv.emplace_back(std::move(layer));
+        }
+    }
+
+    if (layers != offset + header.n_layers * sizeof(LayerHeader)) {
+        throw std::runtime_error(path + " has an inconsistent number of layers");
+    }
+
+    return network;
+}
+
+/**
+ * @brief Save a network to a binary network file so it can be loaded with load_network
+ *
+ * @tparam Scalar the scalar type of the network, which is the type it will be stored as
+ *
+ * @param path    the path to write the network file to
+ * @param network the network to save
+ */
+template <typename Scalar>
+void save_network(const std::string& path, const NetworkStructure<Scalar>& network) {
+    using namespace network_file;
+    static_assert(std::is_same<Scalar, float>::value || std::is_same<Scalar, double>::value,
+                  "Network files can only store float or double networks");
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) { throw std::runtime_error("Failed to open " + path + " for writing"); }
+
+    Header header{MAGIC, VERSION, ORDER_MARK, sizeof(Scalar), uint32_t(network.size()), 0};
+    for (const auto& conv : network) {
+        header.n_layers += conv.size();
+    }
+
+    // Work out where everything will go
+    const uint64_t alignment = PackedWeights<Scalar>::alignment;
+    uint64_t offset = sizeof(Header) + header.n_groups * sizeof(uint32_t) + header.n_layers * sizeof(LayerHeader);
+    std::vector<LayerHeader> layers;
+    std::vector<PackedWeights<Scalar>> weights;
+    for (const auto& conv : network) {
+        for (const auto& layer : conv) {
+            weights.emplace_back(layer.packed());
+            const auto& w = weights.back();
+            if (w.cols() != layer.biases.size()) {
+                throw std::runtime_error("The number of weights and biases in a layer do not match");
+            }
+
+            LayerHeader l{};
+            l.activation = layer.activation;
+            l.rows       = w.rows();
+            l.cols       = w.cols();
+            l.stride     = PackedWeights<Scalar>::padded(w.cols());
+
+            offset           = (offset + alignment - 1) / alignment * alignment;
+            l.weights_offset = offset;
+            offset += uint64_t(l.rows) * l.stride * sizeof(Scalar);
+            offset          = (offset + alignment - 1) / alignment * alignment;
+            l.biases_offset = offset;
+            offset += l.cols * sizeof(Scalar);
+
+            layers.push_back(l);
+        }
+    }
+
+    // Write the headers
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto& conv : network) {
+        const uint32_t n_layers = conv.size();
+        out.write(reinterpret_cast<const char*>(&n_layers), sizeof(n_layers));
+    }
+    out.write(reinterpret_cast<const char*>(layers.data()), layers.size() * sizeof(LayerHeader));
+
+    // Write the weights and biases
+    unsigned int i = 0;
+    for (const auto& conv : network) {
+        for (const auto& layer : conv) {
+            const auto& l = layers[i];
+            const auto& w = weights[i];
+            ++i;
+
+            const std::vector<Scalar> zeros(l.stride - l.cols, Scalar(0));
+            pad(out, alignment);
+            for (uint32_t r = 0; r < l.rows; ++r) {
+                out.write(reinterpret_cast<const char*>(w.row(r)), l.cols * sizeof(Scalar));
+                out.write(reinterpret_cast<const char*>(zeros.data()), zeros.size() * sizeof(Scalar));
+            }
+            pad(out, alignment);
+            out.write(reinterpret_cast<const char*>(layer.biases.data()), l.cols * sizeof(Scalar));
+        }
+    }
+
+    if (!out) { throw std::runtime_error("Failed to write the network to " + path); }
+}
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_NETWORK_FILE_HPP
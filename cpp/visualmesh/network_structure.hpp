@@ -18,6 +18,10 @@
 #ifndef VISUALMESH_NETWORKSTRUCTURE_HPP
 #define VISUALMESH_NETWORKSTRUCTURE_HPP
 
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
 #include <vector>
 
 namespace visualmesh {
@@ -29,6 +33,111 @@ using Weights = std::vector<std::vector<Scalar>>;
 template <typename Scalar>
 using Biases = std::vector<Scalar>;
 
+/**
+ * @brief A weights matrix stored as a single aligned row major block of memory
+ *
+ * @details
+ *  The weights are indexed as [input][output] the same as Weights, however each row is stored contiguously one after
+ *  another with `stride` values between the start of each row. When the packed weights are created from Weights the
+ *  rows are aligned to PackedWeights::alignment bytes and padded with zeros out to the stride, which lets SIMD code
+ *  load whole vectors from any row. The memory is held by a shared pointer so copying packed weights is cheap and the
+ *  values can be owned by something else, for example a memory mapped file.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+class PackedWeights {
+public:
+    /// The alignment in bytes of the start of each row when the weights are packed from Weights
+    static constexpr std::size_t alignment = 64;
+
+    /// Construct an empty weights matrix
+    PackedWeights() = default;
+
+    /**
+     * @brief Pack a vector of vectors weights matrix
+     *
+     * @param weights the weights to pack, indexed as [input][output]
+     */
+    explicit PackedWeights(const Weights<Scalar>& weights)
+      : n_rows(weights.size()), n_cols(weights.empty() ? 0 : weights.front().size()), n_stride(padded(n_cols)) {
+
+        // Allocate enough extra that we can align the start of the block
+        const std::size_t size = n_rows * n_stride;
+        auto storage           = std::make_shared<std::vector<Scalar>>(size + alignment / sizeof(Scalar), Scalar(0));
+        void* ptr              = storage->data();
+        std::size_t space      = storage->size() * sizeof(Scalar);
+        Scalar* block          = reinterpret_cast<Scalar*>(std::align(alignment, size * sizeof(Scalar), ptr, space));
+
+        for (std::size_t i = 0; i < n_rows; ++i) {
+            if (weights[i].size() != n_cols) { throw std::runtime_error("The rows of a weights matrix must be equal"); }
+            std::copy(weights[i].begin(), weights[i].end(), block + i * n_stride);
+        }
+        values = std::shared_ptr<const Scalar>(storage, block);
+    }
+
+    /**
+     * @brief Use weights that are already stored in the packed layout
+     *
+     * @param values the weight values, of which rows * stride must be readable
+     * @param rows   the number of rows (inputs) in the matrix
+     * @param cols   the number of columns (outputs) in the matrix
+     * @param stride the number of values between the start of each row, at least cols
+     */
+    PackedWeights(std::shared_ptr<const Scalar> values,
+                  const std::size_t& rows,
+                  const std::size_t& cols,
+                  const std::size_t& stride)
+      : values(std::move(values)), n_rows(rows), n_cols(cols), n_stride(stride) {
+        if (stride < cols) { throw std::runtime_error("The stride of a weights matrix must be at least its width"); }
+    }
+
+    /// The number of values each row is padded to when packed from Weights
+    static constexpr std::size_t padded(const std::size_t& cols) {
+        return (cols + alignment / sizeof(Scalar) - 1) / (alignment / sizeof(Scalar)) * (alignment / sizeof(Scalar));
+    }
+
+    /// The number of rows (inputs) in the matrix
+    std::size_t rows() const {
+        return n_rows;
+    }
+    /// The number of columns (outputs) in the matrix
+    std::size_t cols() const {
+        return n_cols;
+    }
+    /// The number of values between the start of each row
+    std::size_t stride() const {
+        return n_stride;
+    }
+    /// True if there are no weights in this matrix
+    bool empty() const {
+        return n_rows == 0 || n_cols == 0;
+    }
+
+    /// A pointer to the first value of the matrix
+    const Scalar* data() const {
+        return values.get();
+    }
+    /// A pointer to the first value of row i
+    const Scalar* row(const std::size_t& i) const {
+        return values.get() + i * n_stride;
+    }
+    /// The weight from input i to output j
+    const Scalar& operator()(const std::size_t& i, const std::size_t& j) const {
+        return values.get()[i * n_stride + j];
+    }
+
+private:
+    /// The weight values
+    std::shared_ptr<const Scalar> values;
+    /// The number of rows in the matrix
+    std::size_t n_rows = 0;
+    /// The number of columns in the matrix
+    std::size_t n_cols = 0;
+    /// The number of values between the start of each row
+    std::size_t n_stride = 0;
+};
+
 enum ActivationFunction {
     SELU,
     RELU,
@@ -36,12 +145,40 @@ enum ActivationFunction {
     TANH,
 };
 
-/// A layer is made up of weights biases and activation function
+/**
+ * @brief A layer is made up of weights biases and activation function
+ *
+ * @details
+ *  The weights can be provided either as a vector of vectors in `weights` or already packed in `packed_weights`. If
+ *  both are provided the packed weights are used. Engines should access the weights through `packed()`.
+ */
 template <typename Scalar>
 struct Layer {
+    Layer() = default;
+
+    /**
+     * @brief Make a layer, which can be brace initialised from just the weights, biases and activation function
+     *
+     * @param weights        the weights as a vector of vectors, which can be empty if packed_weights are given
+     * @param biases         the biases for each output
+     * @param activation     the activation function of the layer
+     * @param packed_weights the weights already in packed form, or empty to pack weights when they are needed
+     */
+    Layer(const Weights<Scalar>& weights,
+          const Biases<Scalar>& biases,
+          const ActivationFunction& activation,
+          const PackedWeights<Scalar>& packed_weights = {})
+      : weights(weights), biases(biases), activation(activation), packed_weights(packed_weights) {}
+
     Weights<Scalar> weights;
     Biases<Scalar> biases;
     ActivationFunction activation;
+    PackedWeights<Scalar> packed_weights;
+
+    /// Get the weights of this layer in packed form, packing them if they were only provided as Weights
+    PackedWeights<Scalar> packed() const {
+        return packed_weights.empty() ? PackedWeights<Scalar>(weights) : packed_weights;
+    }
 };
 
 /// A convolutional layer is made up of a list of network layers
@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_PREPARED_LENS_HPP
+#define VISUALMESH_PREPARED_LENS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "lens.hpp"
+#include "utility/math.hpp"
+#include "utility/projection.hpp"
+
+namespace visualmesh {
+
+/**
+ * @brief A lens along with everything that can be worked out from it ahead of time
+ *
+ * @details
+ *  Looking up and projecting a mesh needs several values that only depend on the lens, such as the inverse distortion
+ *  coefficients and the rays through the edges of the screen, which need trigonometric functions to calculate. A
+ *  PreparedLens calculates these once so they can be reused for every frame that uses the same lens. A Lens can be
+ *  used anywhere a PreparedLens is expected in which case it is prepared on the spot.
+ *
+ *  It can also hold a table of r_d(theta) / sin(theta) against the cosine of theta which the batch projection will
+ *  interpolate instead of calculating the lens function. Rays outside the field of view of the lens are clamped to
+ *  its edge, so only use the table for rays that a lookup has found to be on screen. With linear interpolation the
+ *  error shrinks with the square of the size of the table, a 4096 entry table is accurate to around 1e-5 pixels for
+ *  typical lenses. This mostly helps equidistant lenses whose projection otherwise needs an approximation of acos.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ */
+template <typename Scalar>
+class PreparedLens {
+public:
+    PreparedLens() = default;
+
+    /**
+     * @brief Prepare a lens
+     *
+     * @param lens       the lens to prepare
+     * @param table_size the number of entries in the projection table, or 0 to not make one
+     */
+    PreparedLens(const Lens<Scalar>& lens, const int& table_size = 0) {
+        update(lens, table_size);
+    }
+
+    /**
+     * @brief Prepare a new lens, doing nothing if it is the same as the lens that is already prepared
+     *
+     * @param lens       the lens to prepare
+     * @param table_size the number of entries in the projection table, or 0 to not make one
+     */
+    void update(const Lens<Scalar>& lens, const int& table_size = 0) {
+        if (prepared && lens == this->lens && std::size_t(table_size) == table.size()) { return; }
+        if (table_size < 0 || table_size == 1) {
+            throw std::runtime_error("A projection table needs either no entries or at least two");
+        }
+
+        this->lens = lens;
+        ik         = inverse_coefficients(lens.k);
+        cos_fov    = std::cos(lens.fov * Scalar(0.5));
+        sin_fov    = std::sin(lens.fov * Scalar(0.5));
+
+        /* The labels for each of the corners of the screen in cam space are is shown below.
+         * ^    T       U
+         * |        C
+         * z    W       V
+         * <- y
+         */
+        // Add a 1 pixel offset from the edge so that we don't go over the edge from rounding errors
+        const vec2<Scalar> dimensions = subtract(cast<Scalar>(lens.dimensions), Scalar(1.0));
+        corners                       = {{
+          visualmesh::unproject(vec2<Scalar>{1, 1}, lens),                          // rTCc
+          visualmesh::unproject(vec2<Scalar>{dimensions[0], 1}, lens),              // rUCc
+          visualmesh::unproject(vec2<Scalar>{dimensions[0], dimensions[1]}, lens),  // rVCc
+          visualmesh::unproject(vec2<Scalar>{1, dimensions[1]}, lens),              // rWCc
+        }};
+
+        /* The labels for each of the edge centres of the screen in cam space are is shown below.
+         * ^        D
+         * |    G   C   E
+         * z        F
+         * <- y
+         */
+        // These use the lens axis as the centre
+        const vec2<Scalar> centre = add(multiply(dimensions, Scalar(0.5)), lens.centre);
+        edge_centres              = {{
+          visualmesh::unproject(vec2<Scalar>{centre[0], 1}, lens),              // rDCc
+          visualmesh::unproject(vec2<Scalar>{dimensions[0], centre[1]}, lens),  // rECc
+          visualmesh::unproject(vec2<Scalar>{centre[0], dimensions[1]}, lens),  // rFCc
+          visualmesh::unproject(vec2<Scalar>{1, centre[1]}, lens),              // rGCc
+        }};
+
+        make_table(table_size);
+        prepared = true;
+    }
+
+    /// The lens that was prepared
+    Lens<Scalar> lens{};
+    /// The inverse distortion coefficients of the lens
+    vec4<Scalar> ik{};
+    /// The cosine of half the field of view
+    Scalar cos_fov = 1;
+    /// The sine of half the field of view
+    Scalar sin_fov = 0;
+    /// The rays through the four corners of the screen in camera space, one pixel in from the edge
+    std::array<vec3<Scalar>, 4> corners{};
+    /// The rays through the centre of the four edges of the screen in camera space, one pixel in from the edge
+    std::array<vec3<Scalar>, 4> edge_centres{};
+
+    /// The cosine of theta for the first entry in the projection table
+    Scalar table_start = 1;
+    /// The number of entries in the projection table for each unit of the cosine of theta
+    Scalar table_scale = 0;
+    /// r_d(theta) / sin(theta) for evenly spaced values of cos(theta) from table_start to 1
+    std::vector<Scalar> table;
+
+private:
+    /// Fill the projection table using double precision and exact trigonometric functions
+    void make_table(const int& size) {
+        table.resize(size);
+        if (size == 0) { return; }
+
+        // Past the edge of a rectilinear lens or directly behind a fisheye lens the table would be infinite
+        const double limit = lens.projection == RECTILINEAR ? 1e-3 : -1.0 + 1e-3;
+        const double start = std::max(std::cos(std::min(double(lens.fov) * 0.5, M_PI)), limit);
+        const double step  = (1.0 - start) / (size - 1);
+        table_start        = start;
+        table_scale        = 1.0 / step;
+
+        const double f = lens.focal_length;
+        const vec4<double> ik_d{{double(ik[0]), double(ik[1]), double(ik[2]), double(ik[3])}};
+        for (int i = 0; i < size; ++i) {
+            const double x = std::min(start + i * step, 1.0);
+            // As theta goes to 0 every lens function goes to f * theta and so the ratio goes to f
+            if (x >= 1.0) { table[i] = f; }
+            else {
+                const double theta = std::acos(x);
+                double r_u;
+                switch (lens.projection) {
+                    case RECTILINEAR: r_u = rectilinear::r(theta, f); break;
+                    case EQUISOLID: r_u = equisolid::r(theta, f); break;
+                    case EQUIDISTANT: r_u = equidistant::r(theta, f); break;
+                    default: throw std::runtime_error("Cannot project: Unknown lens type"); break;
+                }
+                table[i] = distort(r_u, ik_d) / std::sqrt(1.0 - x * x);
+            }
+        }
+    }
+
+    /// If a lens has been prepared yet
+    bool prepared = false;
+};
+
+namespace detail {
+
+    /**
+     * @brief Works out r_d(theta) / sin(theta) from the cosine of theta by interpolating in a projection table
+     */
+    template <typename Scalar>
+    struct Interpolated {
+        const Scalar* table;
+        int size;
+        Scalar start;
+        Scalar scale;
+
+        inline Scalar operator()(const Scalar& x) const {
+            const Scalar t = (std::min(std::max(x, start), Scalar(1)) - start) * scale;
+            const int i    = std::min(int(t), size - 2);
+            const Scalar u = t - Scalar(i);
+            return table[i] + u * (table[i + 1] - table[i]);
+        }
+    };
+
+}  // namespace detail
+
+/**
+ * @brief Projects a unit vector into a pixel coordinate using a prepared lens
+ *
+ * @details
+ *  This gives exactly the same result as projecting with the lens that was prepared.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param ray   the unit vector to project
+ * @param lens  the prepared lens that we are using to project
+ *
+ * @return a pixel coordinate that this vector projects into
+ */
+template <typename Scalar>
+vec2<Scalar> project(const vec3<Scalar>& ray, const PreparedLens<Scalar>& lens) {
+    return project(ray, lens.lens, lens.ik);
+}
+
+/**
+ * @brief Projects many unit vectors into pixel coordinates at once using a prepared lens
+ *
+ * @details
+ *  If the lens has a projection table it is interpolated to find the pixel coordinates, otherwise this is the same as
+ *  projecting with the lens that was prepared.
+ *
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ *
+ * @param x       the x component of each unit vector in camera space
+ * @param y       the y component of each unit vector in camera space
+ * @param z       the z component of each unit vector in camera space
+ * @param n       the number of vectors to project
+ * @param lens    the prepared lens that we are using to project
+ * @param pixels  where to write the n pixel coordinates that the vectors project into
+ */
+template <typename Scalar>
+void project(const Scalar* x,
+             const Scalar* y,
+             const Scalar* z,
+             const int& n,
+             const PreparedLens<Scalar>& lens,
+             vec2<Scalar>* pixels) {
+    if (lens.table.empty()) { detail::project(x, y, z, n, lens.lens, lens.ik, pixels); }
+    else {
+        const detail::Interpolated<Scalar> scale{
+          lens.table.data(), int(lens.table.size()), lens.table_start, lens.table_scale};
+        detail::project(x, y, z, n, lens.lens, scale, pixels);
+    }
+}
+
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_PREPARED_LENS_HPP
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_UTILITY_ID_CACHE_HPP
+#define VISUALMESH_UTILITY_ID_CACHE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <utility>
+
+namespace visualmesh {
+namespace util {
+
+    /**
+     * @brief Values that an engine keeps for each mesh it is used with, keyed by the id of the mesh
+     *
+     * @details
+     *  Mesh ids are never reused, so a value can never be mistaken for one that belongs to a different mesh that was
+     *  made at the same address. Meshes that have been destroyed or changed are never looked up again, so once there
+     *  are more than capacity values the least recently used one is dropped. The values are often as large as the mesh
+     *  itself so the capacity should be small, otherwise the caches of an engine can hold on to more memory than a
+     *  VisualMesh with a memory budget is allowed to use.
+     *
+     * @tparam T the type of value to store for each mesh
+     */
+    template <typename T>
+    class IdCache {
+    public:
+        /**
+         * @brief Make an empty cache
+         *
+         * @param capacity the number of meshes to keep values for
+         */
+        explicit IdCache(const std::size_t& capacity) : capacity(capacity) {}
+
+        /// Get the value for a mesh id, default constructing it if there isn't one, and mark it as most recently used
+        T& operator[](const uint64_t& id) {
+            auto& entry = entries[id];
+            entry.first = ++clock;
+
+            // The entry we just used has the newest time so it is never the one that is dropped
+            if (entries.size() > capacity) {
+                entries.erase(std::min_element(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+                    return a.second.first < b.second.first;
+                }));
+            }
+            return entry.second;
+        }
+
+        /// Drop all the stored values
+        void clear() {
+            entries.clear();
+        }
+
+        /// The number of meshes that values are stored for
+        std::size_t size() const {
+            return entries.size();
+        }
+
+    private:
+        using Entry = std::pair<const uint64_t, std::pair<uint64_t, T>>;
+
+        /// The largest number of values to keep
+        std::size_t capacity;
+        /// Counts up each time a value is used so the least recently used value can be found
+        uint64_t clock = 0;
+        /// The time each value was last used and the value, keyed by the id of the mesh it is for
+        std::map<uint64_t, std::pair<uint64_t, T>> entries;
+    };
+
+}  // namespace util
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_ID_CACHE_HPP
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_UTILITY_MAPPED_FILE_HPP
+#define VISUALMESH_UTILITY_MAPPED_FILE_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <system_error>
+
+namespace visualmesh {
+namespace util {
+
+    /**
+     * @brief A read only memory mapping of an entire file which is unmapped when this object is destroyed
+     *
+     * @details
+     *  The file is mapped shared, so multiple processes that map the same file will share the same physical pages. The
+     *  start of the mapping is page aligned, so any offset in the file that is aligned will also be aligned in memory.
+     */
+    class MappedFile {
+    public:
+        /**
+         * @brief Map a file into memory
+         *
+         * @param path the path to the file to map
+         *
+         * @throws std::system_error if the file could not be opened or mapped
+         */
+        explicit MappedFile(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) { throw std::system_error(errno, std::system_category(), "Failed to open " + path); }
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::system_category(), "Failed to stat " + path);
+            }
+            length = st.st_size;
+
+            // mmap does not allow empty mappings so an empty file just has no data
+            if (length > 0) {
+                void* ptr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+                if (ptr == MAP_FAILED) {
+                    int error = errno;
+                    ::close(fd);
+                    throw std::system_error(error, std::system_category(), "Failed to map " + path);
+                }
+                address = ptr;
+            }
+
+            // The mapping stays valid after the file descriptor is closed
+            ::close(fd);
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile() {
+            if (address != nullptr) { ::munmap(address, length); }
+        }
+
+        /// The start of the mapped file
+        const void* data() const {
+            return address;
+        }
+
+        /// The size of the mapped file in bytes
+        std::size_t size() const {
+            return length;
+        }
+
+    private:
+        /// The address the file is mapped at
+        void* address = nullptr;
+        /// The length of the mapping in bytes
+        std::size_t length = 0;
+    };
+
+}  // namespace util
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_MAPPED_FILE_HPP
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_UTILITY_REVERSE_INDEX_HPP
+#define VISUALMESH_UTILITY_REVERSE_INDEX_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace visualmesh {
+namespace util {
+
+    /**
+     * @brief A map from the index of a node in a mesh to its index in a projected mesh that can be reused every frame
+     *
+     * @details
+     *  Each entry is stamped with the epoch it was written in and reset starts a new epoch, so any entry that was not
+     *  written since the last reset reads as missing without the storage ever needing to be cleared. Once the storage
+     *  has grown to the size of the largest mesh, building the map for a frame only touches the entries for the points
+     *  that are on screen. Different keys can be set from different threads at the same time.
+     */
+    class ReverseIndex {
+    public:
+        /**
+         * @brief Forget all the stored values and make sure that keys up to (but not including) size can be used
+         *
+         * @param size one past the largest key that will be used until the next reset
+         */
+        void reset(const std::size_t& size) {
+            // Entries that are added have epoch 0 which is never current
+            if (entries.size() < size) { entries.resize(size, Entry{0, 0}); }
+
+            // If the epoch wraps around old entries could look current, so clear them all
+            if (++epoch == 0) {
+                std::fill(entries.begin(), entries.end(), Entry{0, 0});
+                epoch = 1;
+            }
+        }
+
+        /// Store the value for a key in the current epoch
+        void set(const int& key, const int& value) {
+            entries[key] = Entry{epoch, value};
+        }
+
+        /// Get the value for a key if it was set since the last reset, otherwise return the fallback
+        int get(const int& key, const int& fallback) const {
+            const Entry& e = entries[key];
+            return e.epoch == epoch ? e.value : fallback;
+        }
+
+    private:
+        struct Entry {
+            /// The epoch this entry was written in
+            uint32_t epoch;
+            /// The value that was stored
+            int value;
+        };
+
+        /// The current epoch, entries with any other epoch are treated as missing
+        uint32_t epoch = 0;
+        /// The stored value for each key
+        std::vector<Entry> entries;
+    };
+
+}  // namespace util
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_REVERSE_INDEX_HPP
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_UTILITY_THREAD_POOL_HPP
+#define VISUALMESH_UTILITY_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace visualmesh {
+namespace util {
+
+    /**
+     * @brief A persistent pool of threads that executes index ranges in parallel using work stealing
+     *
+     * @details
+     *  Work is submitted as a range of indices which is split into chunks and spread over a queue for each worker.
+     *  Workers take chunks from the front of their own queue, and once it is empty steal chunks from the back of the
+     *  other queues so that uneven chunks do not leave threads idle. The thread that submits the work also executes
+     *  chunks while it waits, so nested calls to parallel_for from inside a chunk can not deadlock the pool.
+     */
+    class ThreadPool {
+    private:
+        /// A batch of work that was submitted by a single call to parallel_for
+        struct Batch {
+            /// The function to execute for each chunk
+            std::function<void(int, int)> fn;
+            /// The number of chunks that are yet to finish executing
+            std::atomic<int> remaining;
+            /// The first exception thrown by a chunk which is rethrown in the submitting thread
+            std::exception_ptr error;
+            /// Mutex and condition variable used to wait for this batch to finish
+            std::mutex mutex;
+            std::condition_variable done;
+        };
+
+        /// A single chunk of a batch which is what is stored in the work queues
+        struct Task {
+            std::shared_ptr<Batch> batch;
+            int start;
+            int end;
+        };
+
+        /// The work queue owned by a single worker that other threads may steal from
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+    public:
+        /**
+         * @brief Construct a new Thread Pool
+         *
+         * @param concurrency the total number of threads that will execute work including the submitting thread. A
+         *                    value of 0 or 1 creates no worker threads and all work is executed serially in the caller.
+         */
+        explicit ThreadPool(const unsigned int& concurrency = std::thread::hardware_concurrency())
+          : queues(std::max(1u, concurrency) - 1) {
+            for (unsigned int i = 0; i < queues.size(); ++i) {
+                queues[i] = std::make_unique<Queue>();
+            }
+            for (unsigned int i = 0; i < queues.size(); ++i) {
+                workers.emplace_back([this, i] { run(i); });
+            }
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        ~ThreadPool() {
+            /* mutex scope */ {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                stop = true;
+            }
+            wake.notify_all();
+            for (auto& w : workers) {
+                w.join();
+            }
+        }
+
+        /**
+         * @brief The number of threads that will execute work for a call to parallel_for, including the caller
+         */
+        unsigned int concurrency() const {
+            return workers.size() + 1;
+        }
+
+        /**
+         * @brief Execute a function over the index range [begin, end) in parallel, returning once it has completed
+         *
+         * @details
+         *  The range is split into chunks of `grain` indices (the last chunk may be smaller) and the function is called
+         *  once per chunk with the start and one past the end index of that chunk. Chunks may execute in any order and
+         *  on any thread, so the function must only write to locations that are owned by the indices it is given. If
+         *  any chunk throws, the first exception is rethrown here after all the chunks have finished.
+         *
+         * @tparam Func the type of the function to execute, callable as fn(int start, int end)
+         *
+         * @param begin the first index to process
+         * @param end   one past the last index to process
+         * @param grain the number of indices in each chunk, or 0 to choose a size based on the pool concurrency
+         * @param fn    the function to execute for each chunk
+         */
+        template <typename Func>
+        void parallel_for(const int& begin, const int& end, int grain, Func&& fn) {
+            const int n = end - begin;
+            if (n <= 0) { return; }
+            if (grain <= 0) { grain = std::max(1, n / int(concurrency() * 4)); }
+
+            // If there is only one chunk or nobody to share with just run it here
+            const int n_chunks = (n + grain - 1) / grain;
+            if (n_chunks == 1 || queues.empty()) {
+                fn(begin, end);
+                return;
+            }
+
+            auto batch       = std::make_shared<Batch>();
+            batch->fn        = std::forward<Func>(fn);
+            batch->remaining = n_chunks;
+
+            // Deal the chunks out over the worker queues, counting them first so the count can never go negative
+            /* mutex scope */ {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                queued += n_chunks;
+            }
+            for (int c = 0; c < n_chunks; ++c) {
+                auto& q = *queues[c % queues.size()];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                q.tasks.push_back(Task{batch, begin + c * grain, std::min(end, begin + (c + 1) * grain)});
+            }
+            wake.notify_all();
+
+            // Help out until there is nothing left to steal, then wait for the chunks that are still executing
+            Task task;
+            while (batch->remaining > 0 && steal(0, task)) {
+                execute(task);
+            }
+            std::unique_lock<std::mutex> lock(batch->mutex);
+            batch->done.wait(lock, [&batch] { return batch->remaining == 0; });
+            if (batch->error) { std::rethrow_exception(batch->error); }
+        }
+
+    private:
+        /// Main loop for the worker that owns queue `index`
+        void run(const unsigned int& index) {
+            Task task;
+            while (true) {
+                if (pop(index, task) || steal(index + 1, task)) {
+                    execute(task);
+                    continue;
+                }
+
+                // Nothing to do so sleep until more work is queued
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                wake.wait(lock, [this] { return stop || queued > 0; });
+                if (stop) { return; }
+            }
+        }
+
+        /// Take a task from the front of our own queue
+        bool pop(const unsigned int& index, Task& task) {
+            auto& q = *queues[index];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) { return false; }
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            --queued;
+            return true;
+        }
+
+        /// Take a task from the back of any queue, starting the search at `first`
+        bool steal(const unsigned int& first, Task& task) {
+            for (unsigned int i = 0; i < queues.size(); ++i) {
+                auto& q = *queues[(first + i) % queues.size()];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if (!q.tasks.empty()) {
+                    task = std::move(q.tasks.back());
+                    q.tasks.pop_back();
+                    --queued;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /// Run a single task and notify its batch if it was the last one
+        static void execute(Task& task) {
+            auto batch = std::move(task.batch);
+            std::exception_ptr error;
+            try {
+                batch->fn(task.start, task.end);
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            if (error && !batch->error) { batch->error = error; }
+            if (--batch->remaining == 0) { batch->done.notify_all(); }
+        }
+
+        /// The work queue for each of the workers
+        std::vector<std::unique_ptr<Queue>> queues;
+        /// The worker threads
+        std::vector<std::thread> workers;
+        /// The number of tasks waiting in the queues, used to let the workers sleep when there is no work
+        std::atomic<int> queued{0};
+        /// Set when the pool is being destroyed
+        bool stop = false;
+        /// Mutex and condition variable used to wake the workers when there is work to do
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+    };
+
+}  // namespace util
+}  // namespace visualmesh
+
+#endif  // VISUALMESH_UTILITY_THREAD_POOL_HPP
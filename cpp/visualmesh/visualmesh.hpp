@@ -18,9 +18,19 @@
 #ifndef VISUALMESH_HPP
 #define VISUALMESH_HPP
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <iterator>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -28,9 +38,20 @@
 #include "visualmesh/mesh.hpp"
 #include "visualmesh/model/ring6.hpp"
 #include "visualmesh/utility/math.hpp"
+#include "visualmesh/utility/thread_pool.hpp"
 
 namespace visualmesh {
 
+/**
+ * @brief When the meshes for each height of a VisualMesh are generated
+ *
+ * @details
+ *  EAGER generates every mesh when the VisualMesh is constructed. LAZY generates each mesh the first time it is needed
+ *  on the thread that needs it. BACKGROUND generates each mesh the first time it is needed on another thread, and
+ *  until it is ready uses the closest mesh that has already been generated.
+ */
+enum MeshGeneration { EAGER, LAZY, BACKGROUND };
+
 /**
  * @brief An aggregate of many Visual Meshs at different heights that can be looked up for performance.
  *
@@ -38,6 +59,10 @@ namespace visualmesh {
  *  Provides convenience functions for accessing projection and classification of the mesh using different engines.
  *  The available engines are currently limited to OpenCL and CPU, however CUDA and Vulkan can be added later.
  *
+ *  The meshes can be generated lazily as they are needed and limited to a memory budget, in which case the least
+ *  recently used meshes are dropped to stay within the budget and generated again if they are needed later. Looking up
+ *  a mesh is thread safe, and if several threads need a mesh that has not been generated yet it is only generated once.
+ *
  * @tparam Scalar the type that will hold the vectors <float, double>
  * @tparam Model  the model used to generate the mesh in each of the individual heights
  */
@@ -52,14 +77,25 @@ public:
     /**
      * @brief Generate a new visual mesh for the given shape.
      *
+     * @details
+     *  The heights that need a mesh are found first by bisecting the height range until every height is within the
+     *  allowed error of a mesh. When the meshes are generated eagerly they are independent of each other so they are
+     *  then built in parallel. Each mesh is built deterministically so the result does not depend on the concurrency
+     *  used or on when it is generated.
+     *
      * @tparam Shape the shape type that this mesh will generate using
      *
-     * @param shape        the shape we are generating a visual mesh for
-     * @param min_height   the minimum height that our camera will be at
-     * @param max_height   the maximum height our camera will be at
-     * @param k            the number of intersections with the object
-     * @param max_error    the maximum amount of error in terms of k that a mesh can have
-     * @param max_distance the maximum distance that this mesh will project for
+     * @param shape           the shape we are generating a visual mesh for
+     * @param min_height      the minimum height that our camera will be at
+     * @param max_height      the maximum height our camera will be at
+     * @param k               the number of intersections with the object
+     * @param max_error       the maximum amount of error in terms of k that a mesh can have
+     * @param max_distance    the maximum distance that this mesh will project for
+     * @param cache_directory a directory to cache the generated meshes in, or empty to always generate the meshes
+     * @param concurrency     the number of threads to use when building the meshes
+     * @param generation      when the meshes for each height are generated
+     * @param memory_budget   the most bytes the generated meshes can use before the least recently used are dropped, or
+     *                        0 to keep every mesh once it is generated
      */
     template <typename Shape>
     explicit VisualMesh(const Shape& shape,
@@ -67,11 +103,15 @@ public:
                         const Scalar& max_height,
                         const Scalar& k,
                         const Scalar& max_error,
-                        const Scalar& max_distance) {
+                        const Scalar& max_distance,
+                        const std::string& cache_directory = "",
+                        const unsigned int& concurrency    = std::thread::hardware_concurrency(),
+                        const MeshGeneration& generation   = EAGER,
+                        const std::size_t& memory_budget   = 0)
+      : generation(generation), memory_budget(memory_budget) {
 
-        // Add an element for the min and max height
-        luts.insert(std::make_pair(min_height, Mesh<Scalar, Model>(shape, min_height, k, max_distance)));
-        luts.insert(std::make_pair(max_height, Mesh<Scalar, Model>(shape, max_height, k, max_distance)));
+        // We always need a mesh for the min and max height
+        std::vector<Scalar> heights = {min_height, max_height};
 
         // Run through a stack splitting the range in two until the region is filled appropriately
         std::vector<vec2<Scalar>> stack;
@@ -88,52 +128,251 @@ public:
 
             // If we aren't close enough to both elements
             if (lower_err > max_error || upper_err > max_error) {
-                luts.insert(std::make_pair(h, Mesh<Scalar, Model>(shape, h, k, max_distance)));
+                heights.push_back(h);
                 stack.emplace_back(vec2<Scalar>{range[0], h});
                 stack.emplace_back(vec2<Scalar>{h, range[1]});
             }
         }
+
+        // Remove any duplicate heights so each mesh is only built once
+        std::sort(heights.begin(), heights.end());
+        heights.erase(std::unique(heights.begin(), heights.end()), heights.end());
+        for (const auto& h : heights) {
+            buckets[h];
+        }
+
+        // Everything needed to generate a mesh is copied so it can be used on another thread after this is gone
+        generate = [shape, k, max_distance, cache_directory, concurrency](const Scalar& h) {
+            return std::make_shared<Mesh<Scalar, Model>>(shape, h, k, max_distance, cache_directory, concurrency);
+        };
+
+        if (generation == EAGER) {
+            // Build all the meshes in parallel, sharing out any threads that are left over to build each mesh
+            std::vector<std::shared_ptr<Mesh<Scalar, Model>>> meshes(heights.size());
+            util::ThreadPool pool(concurrency);
+            const unsigned int mesh_concurrency =
+              std::max(1u, concurrency / static_cast<unsigned int>(heights.size()));
+            pool.parallel_for(0, heights.size(), 1, [&](const int& start, const int& end) {
+                for (int i = start; i < end; ++i) {
+                    meshes[i] = std::make_shared<Mesh<Scalar, Model>>(
+                      shape, heights[i], k, max_distance, cache_directory, mesh_concurrency);
+                }
+            });
+
+            for (unsigned int i = 0; i < heights.size(); ++i) {
+                buckets[heights[i]].mesh = meshes[i];
+                bytes += meshes[i]->bytes();
+            }
+            evict(nullptr);
+        }
     }
 
     /**
      * @brief Converts a VisualMesh object of a different Scalar to this Scalar type
      *
+     * @details
+     *  Only the meshes that have already been generated are converted, the rest are converted as they are generated.
+     *
      * @tparam U the Scalar type of the other VisualMesh object
      *
      * @param b the other VisualMesh object to convert from
      */
     template <typename U>
     VisualMesh(const VisualMesh<U, Model>& b) {
-        for (const auto& lut : b.luts) {
-            luts.insert(
-              std::make_pair(static_cast<Scalar>(lut.first), static_cast<const Mesh<Scalar, Model>>(lut.second)));
+        std::lock_guard<std::mutex> lock(b.mutex);
+        generation    = b.generation;
+        memory_budget = b.memory_budget;
+        for (const auto& bucket : b.buckets) {
+            Bucket& converted = buckets[static_cast<Scalar>(bucket.first)];
+            if (bucket.second.mesh) {
+                converted.mesh      = std::make_shared<const Mesh<Scalar, Model>>(*bucket.second.mesh);
+                converted.last_used = bucket.second.last_used;
+                bytes += converted.mesh->bytes();
+            }
+        }
+        clock = b.clock;
+
+        if (b.generate) {
+            generate = [g = b.generate](const Scalar& h) {
+                return std::make_shared<Mesh<Scalar, Model>>(*g(static_cast<U>(h)));
+            };
         }
     }
 
+    VisualMesh(const VisualMesh& other) {
+        std::lock_guard<std::mutex> lock(other.mutex);
+        copy(other);
+    }
+
+    VisualMesh& operator=(const VisualMesh& other) {
+        if (this != &other) {
+            std::lock(mutex, other.mutex);
+            std::lock_guard<std::mutex> lock(mutex, std::adopt_lock);
+            std::lock_guard<std::mutex> other_lock(other.mutex, std::adopt_lock);
+            copy(other);
+        }
+        return *this;
+    }
+
     /**
-     * Find a visual mesh that exists at a specific height above the observation plane.
-     * This only looks up meshes that were created during instantiation.
-     * If this lookup is out of range, it will return the highest or lowest mesh (whichever is closer)
+     * @brief Store the nodes of every mesh in compact form to save memory, see Mesh::compact
      *
-     * @param  height the height above the observation plane for the mesh we are trying to find
+     * @details
+     *  Any meshes that are generated afterwards are also made compact. This waits for any meshes that are being
+     *  generated to finish, and the meshes that are already in use elsewhere are left as they are.
+     */
+    void compact() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (generate) {
+            generate = [g = generate](const Scalar& h) {
+                auto mesh = g(h);
+                mesh->compact();
+                return mesh;
+            };
+        }
+
+        for (auto& bucket : buckets) {
+            if (bucket.second.pending.valid()) {
+                auto pending = bucket.second.pending;
+                lock.unlock();
+                pending.wait();
+                lock.lock();
+            }
+        }
+        collect();
+
+        for (auto& bucket : buckets) {
+            auto& mesh = bucket.second.mesh;
+            if (mesh && !mesh->is_compact()) {
+                auto compacted = std::make_shared<Mesh<Scalar, Model>>(*mesh);
+                compacted->compact();
+                bytes = bytes - mesh->bytes() + compacted->bytes();
+                mesh  = compacted;
+            }
+        }
+        evict(nullptr);
+    }
+
+    /**
+     * @brief Find the visual mesh that exists closest to a specific height above the observation plane.
+     *
+     * @details
+     *  Only the heights that were chosen during instantiation have a mesh. If this lookup is out of range, it will
+     *  return the highest or lowest mesh (whichever is closer). If the mesh for that height has not been generated it
+     *  is generated now, or in the background in which case the closest mesh that has been generated is returned
+     *  until it is ready.
      *
-     * @return the closest generated visual mesh to the provided height
+     * @param height the height above the observation plane for the mesh we are trying to find
+     *
+     * @return the closest visual mesh to the provided height, which stays valid for as long as it is held
      */
-    const Mesh<Scalar, Model>& height(const Scalar& height) const {
+    std::shared_ptr<const Mesh<Scalar, Model>> get(const Scalar& height) const {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (buckets.empty()) { throw std::runtime_error("Cannot find a mesh in a VisualMesh with no meshes"); }
+
+        // If there is no element that is >= height we are off the high end, and if it is the first element we are
+        // off the low end, otherwise see if this element has less error than the previous one
+        auto it = buckets.lower_bound(height);
+        if (it == buckets.end()) { it = std::prev(it); }
+        else if (it != buckets.begin() && std::abs(it->first - height) >= std::abs(std::prev(it)->first - height)) {
+            it = std::prev(it);
+        }
 
-        auto it = luts.lower_bound(height);
+        Bucket& bucket   = it->second;
+        bucket.last_used = ++clock;
+        if (bucket.mesh) { return bucket.mesh; }
 
-        // First element that is >= is the first one (we are off the low end)
-        if (it == luts.begin()) { return it->second; }
-        // We don't have an element that >= height (we are off the high end)
-        else if (it == luts.end()) {
-            return luts.rbegin()->second;
+        if (generation == BACKGROUND) {
+            // Meshes that finished in the background count towards the budget so we may need to drop some
+            collect();
+            if (bucket.mesh) {
+                evict(bucket.mesh);
+                return bucket.mesh;
+            }
+
+            if (!bucket.pending.valid()) {
+                bucket.pending = std::async(std::launch::async, [g = generate, h = it->first] {
+                                     return std::shared_ptr<const Mesh<Scalar, Model>>(g(h));
+                                 }).share();
+            }
+
+            // Use the closest mesh we have while this one is generated, and only wait if there isn't one
+            if (bucket.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                auto closest = buckets.end();
+                for (auto b = buckets.begin(); b != buckets.end(); ++b) {
+                    if (b->second.mesh
+                        && (closest == buckets.end()
+                            || std::abs(b->first - height) < std::abs(closest->first - height))) {
+                        closest = b;
+                    }
+                }
+                if (closest != buckets.end()) {
+                    closest->second.last_used = clock;
+                    evict(closest->second.mesh);
+                    return closest->second.mesh;
+                }
+            }
+        }
+
+        // Generate the mesh on this thread unless it is already being generated somewhere else
+        std::promise<std::shared_ptr<const Mesh<Scalar, Model>>> promise;
+        const bool build = !bucket.pending.valid();
+        if (build) { bucket.pending = promise.get_future().share(); }
+
+        // Wait for the mesh without holding the lock so other heights can still be found
+        const auto pending = bucket.pending;
+        const auto g       = generate;
+        lock.unlock();
+        if (build) {
+            try {
+                promise.set_value(g(it->first));
+            }
+            catch (...) {
+                promise.set_exception(std::current_exception());
+            }
         }
-        // Otherwise see if this element has less error than the previous one
-        else {
-            return std::abs(it->first - height) < std::abs(std::prev(it)->first - height) ? it->second
-                                                                                          : std::prev(it)->second;
+
+        std::shared_ptr<const Mesh<Scalar, Model>> mesh;
+        try {
+            mesh = pending.get();
+        }
+        catch (...) {
+            // Forget the failure so that the next time this mesh is needed it is tried again
+            lock.lock();
+            if (!bucket.mesh) { bucket.pending = {}; }
+            throw;
+        }
+        lock.lock();
+
+        // Another thread may have already stored the mesh when it found it was ready
+        if (!bucket.mesh) {
+            bucket.mesh = mesh;
+            bytes += mesh->bytes();
+        }
+        bucket.pending = {};
+        evict(bucket.mesh);
+        return bucket.mesh;
+    }
+
+    /**
+     * @brief Find the visual mesh that exists closest to a specific height above the observation plane, see get
+     *
+     * @details
+     *  Without a memory budget a mesh is never dropped once it is generated, so the returned reference stays valid for
+     *  as long as this visual mesh does. With a budget any mesh could be dropped by the next lookup, so use get
+     *  instead as it keeps the mesh alive while it is needed.
+     *
+     * @param height the height above the observation plane for the mesh we are trying to find
+     *
+     * @return the closest visual mesh to the provided height
+     *
+     * @throws std::logic_error if there is a memory budget
+     */
+    const Mesh<Scalar, Model>& height(const Scalar& height) const {
+        if (memory_budget > 0) {
+            throw std::logic_error("A visual mesh with a memory budget can drop meshes, use get instead of height");
         }
+        return *get(height);
     }
 
     /**
@@ -144,18 +383,94 @@ public:
      *
      * @return the mesh that was used for this lookup and a vector of start/end indices that are on the screen.
      */
-    std::pair<const Mesh<Scalar, Model>&, std::vector<std::pair<int, int>>> lookup(const mat4<Scalar>& Hoc,
-                                                                                   const Lens<Scalar>& lens) const {
+    std::pair<std::shared_ptr<const Mesh<Scalar, Model>>, std::vector<std::pair<int, int>>> lookup(
+      const mat4<Scalar>& Hoc,
+      const Lens<Scalar>& lens) const {
 
         // z height from the transformation matrix
         const Scalar& h = Hoc[2][3];
-        auto mesh       = height(h);
-        return mesh->lookup(Hoc, lens);
+        auto mesh       = get(h);
+        return std::make_pair(mesh, mesh->lookup(Hoc, lens));
+    }
+
+    /// The number of bytes used by the meshes that have been generated
+    std::size_t memory() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return bytes;
     }
 
 private:
-    /// A map from heights to visual mesh tables
-    std::map<Scalar, const Mesh<Scalar, Model>> luts;
+    /// A mesh for a single height, which is generated when it is needed
+    struct Bucket {
+        /// The mesh, or null if it has not been generated or was dropped to stay within the memory budget
+        std::shared_ptr<const Mesh<Scalar, Model>> mesh;
+        /// The mesh while it is being generated, or invalid if it is not
+        std::shared_future<std::shared_ptr<const Mesh<Scalar, Model>>> pending;
+        /// When this mesh was last used, so the least recently used meshes can be dropped first
+        uint64_t last_used = 0;
+    };
+
+    /// Copy the state of another visual mesh, holding both of their locks
+    void copy(const VisualMesh& other) {
+        buckets       = other.buckets;
+        generate      = other.generate;
+        generation    = other.generation;
+        memory_budget = other.memory_budget;
+        clock         = other.clock;
+        bytes         = other.bytes;
+    }
+
+    /// Store any meshes that have finished generating in the background, holding the lock
+    void collect() const {
+        for (auto& bucket : buckets) {
+            auto& b = bucket.second;
+            if (b.pending.valid() && b.pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                // Failures are left to be reported to the next thread that needs this mesh
+                try {
+                    auto mesh = b.pending.get();
+                    if (!b.mesh) {
+                        b.mesh = mesh;
+                        bytes += mesh->bytes();
+                    }
+                    b.pending = {};
+                }
+                catch (...) {
+                }
+            }
+        }
+    }
+
+    /// Drop the least recently used meshes other than keep until they fit in the memory budget, holding the lock
+    void evict(const std::shared_ptr<const Mesh<Scalar, Model>>& keep) const {
+        while (memory_budget > 0 && bytes > memory_budget) {
+            auto oldest = buckets.end();
+            for (auto b = buckets.begin(); b != buckets.end(); ++b) {
+                if (b->second.mesh && b->second.mesh != keep
+                    && (oldest == buckets.end() || b->second.last_used < oldest->second.last_used)) {
+                    oldest = b;
+                }
+            }
+            if (oldest == buckets.end()) { break; }
+
+            bytes -= oldest->second.mesh->bytes();
+            oldest->second.mesh.reset();
+        }
+    }
+
+    /// A map from heights to the mesh for that height
+    mutable std::map<Scalar, Bucket> buckets;
+    /// Generates the mesh for a height
+    std::function<std::shared_ptr<Mesh<Scalar, Model>>(const Scalar&)> generate;
+    /// When the meshes for each height are generated
+    MeshGeneration generation = EAGER;
+    /// The most bytes the generated meshes can use, or 0 for no limit
+    std::size_t memory_budget = 0;
+    /// Counts each time a mesh is used to track which was used least recently
+    mutable uint64_t clock = 0;
+    /// The number of bytes used by the meshes that have been generated
+    mutable std::size_t bytes = 0;
+    /// Protects the meshes as they are generated and dropped
+    mutable std::mutex mutex;
 
     template <typename S, template <typename> class M>
     friend class VisualMesh;
@@ -22,6 +22,7 @@
 #include <string>
 #include <thread>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "Timer.hpp"
@@ -41,11 +42,17 @@ using Scalar = float;
 template <typename Engine, typename Mesh>
 class Benchmarker {
 public:
+    template <typename... EngineArgs>
     Benchmarker(const visualmesh::NetworkStructure<Scalar>& network,
                 const Mesh& mesh,
                 const std::vector<dataset_element<Scalar>>& dataset,
-                const int& loops)
-      : total(0), engine(network), mesh(mesh), dataset(dataset), loops(loops) {}
+                const int& loops,
+                EngineArgs&&... engine_args)
+      : total(0)
+      , engine(network, std::forward<EngineArgs>(engine_args)...)
+      , mesh(mesh)
+      , dataset(dataset)
+      , loops(loops) {}
 
     void start() {
         thread = std::thread([this] {
@@ -73,19 +80,21 @@ private:
     std::thread thread;
 };
 
-template <typename Engine, typename Mesh>
+template <typename Engine, typename Mesh, typename... EngineArgs>
 void benchmark(const visualmesh::NetworkStructure<Scalar>& network,
                const std::vector<dataset_element<Scalar>>& dataset,
                const Mesh& mesh,
                const int loops,
-               const int parallelity = 1) {
+               const int parallelity = 1,
+               const EngineArgs&... engine_args) {
 
     using namespace std::chrono;
     Timer t;
     // Build engines
     std::vector<Benchmarker<Engine, Mesh>> benchmarkers;
+    benchmarkers.reserve(parallelity);
     for (int t = 0; t < parallelity; ++t) {
-        benchmarkers.emplace_back(network, mesh, dataset, loops);
+        benchmarkers.emplace_back(network, mesh, dataset, loops, engine_args...);
     }
     t.measure("Built benchmarkers");
 
@@ -138,4 +147,9 @@ int main() {
 
     std::cout << "Benchmarking CPU Engine" << std::endl;
     benchmark<visualmesh::engine::cpu::Engine<Scalar>>(network, dataset, mesh, 2, std::thread::hardware_concurrency());
+
+    // A single engine that splits each frame over all the cores measures latency rather than throughput
+    std::cout << "Benchmarking Multithreaded CPU Engine" << std::endl;
+    benchmark<visualmesh::engine::cpu::Engine<Scalar>>(
+      network, dataset, mesh, 2, 1, std::thread::hardware_concurrency());
 }
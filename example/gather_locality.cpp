@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "visualmesh/geometry/Sphere.hpp"
+#include "visualmesh/mesh.hpp"
+#include "visualmesh/model/nmgrid6.hpp"
+#include "visualmesh/model/ring6.hpp"
+#include "visualmesh/model/xmgrid4.hpp"
+#include "visualmesh/model/xygrid6.hpp"
+
+/**
+ * @brief A set associative cache with least recently used replacement that counts how many of its accesses miss
+ */
+class CacheModel {
+public:
+    CacheModel(const int& size, const int& ways, const int& line)
+      : sets(size / (ways * line)), ways(ways), line(line), tags(sets * ways, -1), ages(sets * ways, 0) {}
+
+    /// Access each cache line that is covered by the bytes from start to one past end
+    void access(const int64_t& start, const int64_t& end) {
+        for (int64_t l = start / line; l <= (end - 1) / line; ++l) {
+            const int set = l % sets;
+            int64_t* t    = &tags[set * ways];
+            uint64_t* a   = &ages[set * ways];
+
+            ++accesses;
+            ++clock;
+            auto hit = std::find(t, t + ways, l);
+            if (hit == t + ways) {
+                ++misses;
+                hit = t + std::distance(a, std::min_element(a, a + ways));
+                *hit = l;
+            }
+            a[std::distance(t, hit)] = clock;
+        }
+    }
+
+    double miss_rate() const {
+        return double(misses) / double(accesses);
+    }
+
+private:
+    int sets;
+    int ways;
+    int line;
+    std::vector<int64_t> tags;
+    std::vector<uint64_t> ages;
+    uint64_t clock    = 0;
+    uint64_t accesses = 0;
+    uint64_t misses   = 0;
+};
+
+/**
+ * @brief Gather the values for each node and its neighbours the same way the engines do for each layer of a network
+ *
+ * @details
+ *  The gathered values are written over the same small block of memory, so that the time only depends on how well the
+ *  reads use the cache and the benchmark does not need memory for the whole output.
+ *
+ * @return the number of microseconds the gather took
+ */
+template <int N_NEIGHBOURS>
+double gather(const std::vector<std::array<int, N_NEIGHBOURS>>& graph,
+              const std::vector<float>& values,
+              const int& dims,
+              std::vector<float>& output) {
+    constexpr unsigned int block = 256;
+
+    const auto start = std::chrono::steady_clock::now();
+    float* out       = output.data();
+    for (unsigned int i = 0; i < graph.size(); ++i) {
+        if (i % block == 0) { out = output.data(); }
+        out = std::copy(values.begin() + i * dims, values.begin() + (i + 1) * dims, out);
+        for (const auto& n : graph[i]) {
+            out = std::copy(values.begin() + n * dims, values.begin() + (n + 1) * dims, out);
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+/**
+ * @brief Print how far apart neighbouring nodes are in memory and how well gathering them uses the cache
+ *
+ * @param name  the name to print for this ordering of the nodes
+ * @param graph the neighbourhood graph, with the off screen node at graph.size()
+ */
+template <int N_NEIGHBOURS>
+void measure(const std::string& name, const std::vector<std::array<int, N_NEIGHBOURS>>& graph) {
+    const int n = graph.size();
+
+    // How many neighbours are within each distance of their node in the list of nodes
+    const std::array<int, 5> distances = {{4, 16, 64, 256, 4096}};
+    std::array<int64_t, 5> within{};
+    int64_t total = 0;
+    for (int i = 0; i < n; ++i) {
+        for (const auto& j : graph[i]) {
+            if (j < n) {
+                for (unsigned int d = 0; d < distances.size(); ++d) {
+                    within[d] += std::abs(i - j) <= distances[d];
+                }
+                ++total;
+            }
+        }
+    }
+
+    std::cout << "  " << std::left << std::setw(8) << name << std::right;
+    for (unsigned int d = 0; d < distances.size(); ++d) {
+        std::cout << " ≤" << std::setw(4) << distances[d] << " " << std::setw(5) << 100.0 * within[d] / total << "%";
+    }
+    std::cout << std::endl;
+
+    for (const int& dims : {4, 16, 32}) {
+        // Model the accesses the gather makes to a 32KiB L1 and a 1MiB L2 cache
+        CacheModel l1(32 * 1024, 8, 64);
+        CacheModel l2(1024 * 1024, 16, 64);
+        const int64_t row = dims * sizeof(float);
+        for (int i = 0; i < n; ++i) {
+            l1.access(i * row, (i + 1) * row);
+            l2.access(i * row, (i + 1) * row);
+            for (const auto& j : graph[i]) {
+                l1.access(j * row, (j + 1) * row);
+                l2.access(j * row, (j + 1) * row);
+            }
+        }
+
+        // Time the real gather, taking the best of a few runs
+        std::vector<float> values((n + 1) * dims, 1.0f);
+        std::vector<float> output(256 * (N_NEIGHBOURS + 1) * dims);
+        double best = std::numeric_limits<double>::max();
+        for (int r = 0; r < 5; ++r) {
+            best = std::min(best, gather<N_NEIGHBOURS>(graph, values, dims, output));
+        }
+
+        std::cout << "    " << std::setw(2) << dims << " values: L1 misses " << std::setw(5) << 100.0 * l1.miss_rate()
+                  << "% L2 misses " << std::setw(5) << 100.0 * l2.miss_rate() << "% gather " << std::setw(8)
+                  << best << "µs" << std::endl;
+    }
+}
+
+template <template <typename> class Model>
+void run(const std::string& name, const double& h, const double& r, const double& k, const double& max_distance) {
+    constexpr int N_NEIGHBOURS = Model<float>::N_NEIGHBOURS;
+
+    visualmesh::geometry::Sphere<float> shape(r);
+    visualmesh::Mesh<float, Model> mesh(shape, h, k, max_distance);
+    const int n = mesh.nodes.size();
+
+    std::vector<std::array<int, N_NEIGHBOURS>> graph;
+    graph.reserve(n);
+    for (const auto& node : mesh.nodes) {
+        graph.push_back(node.neighbours);
+    }
+
+    std::cout << name << " with " << n << " nodes" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    measure<N_NEIGHBOURS>("mesh", graph);
+
+    // The same graph with the nodes in a random order, which is the worst case for the gather
+    std::vector<int> order(n + 1);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end() - 1, std::mt19937());
+    std::vector<std::array<int, N_NEIGHBOURS>> shuffled(n);
+    for (int i = 0; i < n; ++i) {
+        for (int j = 0; j < N_NEIGHBOURS; ++j) {
+            shuffled[order[i]][j] = order[graph[i][j]];
+        }
+    }
+    measure<N_NEIGHBOURS>("shuffled", shuffled);
+    std::cout << std::defaultfloat << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+
+    const double h            = argc > 1 ? std::stof(argv[1]) : 1;
+    const double r            = argc > 2 ? std::stof(argv[2]) : 0.0949996;
+    const double k            = argc > 3 ? std::stof(argv[3]) : 10;
+    const double max_distance = argc > 4 ? std::stof(argv[4]) : 20;
+
+    run<visualmesh::model::Ring6>("Ring6", h, r, k, max_distance);
+    run<visualmesh::model::NMGrid6>("NMGrid6", h, r, k, max_distance);
+    run<visualmesh::model::XMGrid4>("XMGrid4", h, r, k, max_distance);
+    run<visualmesh::model::XYGrid6>("XYGrid6", h, r, k, max_distance);
+}
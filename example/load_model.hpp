@@ -20,6 +20,7 @@
 
 #include <yaml-cpp/yaml.h>
 
+#include "visualmesh/network_file.hpp"
 #include "visualmesh/network_structure.hpp"
 
 visualmesh::ActivationFunction activation_function(const std::string& name) {
@@ -35,6 +36,13 @@ visualmesh::ActivationFunction activation_function(const std::string& name) {
 template <typename Scalar>
 visualmesh::NetworkStructure<Scalar> load_model(const std::string& path) {
 
+    // Binary network files are memory mapped rather than parsed
+    const std::string extension = ".bin";
+    if (path.size() >= extension.size()
+        && path.compare(path.size() - extension.size(), extension.size(), extension) == 0) {
+        return visualmesh::load_network<Scalar>(path);
+    }
+
     visualmesh::NetworkStructure<Scalar> model;
     YAML::Node config = YAML::LoadFile(path);
     for (const auto& conv : config) {
@@ -42,10 +50,12 @@ visualmesh::NetworkStructure<Scalar> load_model(const std::string& path) {
         auto& net_conv = model.back();
 
         for (const auto& layer : conv) {
+            // Only keep the packed version of the weights
             net_conv.emplace_back(visualmesh::Layer<Scalar>{
-              layer["weights"].as<std::vector<std::vector<Scalar>>>(),
+              {},
               layer["biases"].as<std::vector<Scalar>>(),
               activation_function(layer["activation"].as<std::string>()),
+              visualmesh::PackedWeights<Scalar>(layer["weights"].as<std::vector<std::vector<Scalar>>>()),
             });
         }
     }
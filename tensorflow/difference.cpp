@@ -18,8 +18,10 @@
 #include <tensorflow/core/framework/op.h>
 #include <tensorflow/core/framework/op_kernel.h>
 #include <tensorflow/core/framework/shape_inference.h>
+#include <tensorflow/core/util/work_sharder.h>
 
 #include <cmath>
+#include <cstdint>
 #include <functional>
 
 #include "model_op_base.hpp"
@@ -68,6 +70,9 @@ public:
     explicit DifferenceVisualMeshOp(tensorflow::OpKernelConstruction* context)
       : ModelOpBase<T, DifferenceVisualMeshOp<T>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS>(context) {}
 
+    /// Roughly how many cycles it takes to find the difference between a single pair of coordinates
+    static constexpr int64_t COST = 500;
+
     template <template <typename> class Model, typename Shape>
     void DoCompute(tensorflow::OpKernelContext* context, const Shape& shape) {
 
@@ -100,14 +105,19 @@ public:
         vectors_shape.AddDim(2);
         OP_REQUIRES_OK(context, context->allocate_output(Outputs::DIFFERENCES, vectors_shape, &vectors));
 
-        // Perform the map operation for this shape
-        auto ds = vectors->matrix<T>();
-        for (int i = 0; i < n_elems; ++i) {
-            visualmesh::vec2<T> d = Model<T>::difference(
-              shape, height, visualmesh::vec2<T>({c_a(i, 0), c_a(i, 1)}), visualmesh::vec2<T>({c_b(i, 0), c_b(i, 1)}));
-            ds(i, 0) = d[0];
-            ds(i, 1) = d[1];
-        }
+        // Perform the difference operation for this shape, splitting the coordinates over the intra op thread pool
+        auto ds            = vectors->matrix<T>();
+        const auto workers = context->device()->tensorflow_cpu_worker_threads();
+        tensorflow::Shard(workers->num_threads, workers->workers, n_elems, COST, [&](int64_t start, int64_t end) {
+            for (int64_t i = start; i < end; ++i) {
+                visualmesh::vec2<T> d = Model<T>::difference(shape,
+                                                             height,
+                                                             visualmesh::vec2<T>({c_a(i, 0), c_a(i, 1)}),
+                                                             visualmesh::vec2<T>({c_b(i, 0), c_b(i, 1)}));
+                ds(i, 0) = d[0];
+                ds(i, 1) = d[1];
+            }
+        });
     }
 };
 
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <tensorflow/core/framework/op.h>
+#include <tensorflow/core/framework/op_kernel.h>
+#include <tensorflow/core/framework/shape_inference.h>
+#include <tensorflow/core/util/work_sharder.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+enum Args {
+    FEATURES   = 0,
+    NEIGHBOURS = 1,
+};
+
+enum GradArgs {
+    GRADIENTS       = 0,
+    GRAD_NEIGHBOURS = 1,
+    N_POINTS        = 2,
+};
+
+enum Outputs {
+    GATHERED = 0,
+};
+
+REGISTER_OP("GatherVisualMesh")
+  .Attr("T: {float, double}")
+  .Input("features: T")
+  .Input("neighbours: int32")
+  .Output("gathered: T")
+  .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::DimensionHandle width;
+      TF_RETURN_IF_ERROR(
+        c->Multiply(c->Dim(c->input(Args::FEATURES), 1), c->Dim(c->input(Args::NEIGHBOURS), 1), &width));
+      c->set_output(Outputs::GATHERED, c->Matrix(c->Dim(c->input(Args::NEIGHBOURS), 0), width));
+      return tensorflow::Status::OK();
+  });
+
+REGISTER_OP("GatherVisualMeshGrad")
+  .Attr("T: {float, double}")
+  .Input("gradients: T")
+  .Input("neighbours: int32")
+  .Input("n_points: int32")
+  .Output("features: T")
+  .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      tensorflow::shape_inference::DimensionHandle n_points;
+      tensorflow::shape_inference::DimensionHandle depth;
+      TF_RETURN_IF_ERROR(c->MakeDimForScalarInput(GradArgs::N_POINTS, &n_points));
+      TF_RETURN_IF_ERROR(c->Divide(c->Dim(c->input(GradArgs::GRADIENTS), 1),
+                                   c->Dim(c->input(GradArgs::GRAD_NEIGHBOURS), 1),
+                                   true,
+                                   &depth));
+      c->set_output(Outputs::GATHERED, c->Matrix(n_points, depth));
+      return tensorflow::Status::OK();
+  });
+
+/**
+ * @brief The Visual Mesh graph convolution gather op
+ *
+ * @details
+ *  This op gathers the features of each point and its neighbours into a single row, using the neighbourhood graph in
+ *  the same layout that LookupVisualMesh returns, where the first column is the point itself. It gives the same
+ *  result as reshaping tf.gather(features, neighbours) so that each row is one point, but writes the rows directly.
+ *
+ * @tparam T The scalar type used for floating point numbers
+ */
+template <typename T>
+class GatherVisualMeshOp : public tensorflow::OpKernel {
+public:
+    explicit GatherVisualMeshOp(tensorflow::OpKernelConstruction* context) : OpKernel(context) {}
+
+    /// Roughly how many cycles it takes to copy a single value
+    static constexpr int64_t COST = 2;
+
+    void Compute(tensorflow::OpKernelContext* context) override {
+
+        // Check that the shape of each of the inputs is valid
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsMatrix(context->input(Args::FEATURES).shape()),
+                    tensorflow::errors::InvalidArgument("The features must be an nxd matrix"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsMatrix(context->input(Args::NEIGHBOURS).shape()),
+                    tensorflow::errors::InvalidArgument("The neighbours must be an mxk matrix"));
+
+        // Extract information from our input tensors
+        const T* features          = context->input(Args::FEATURES).flat<T>().data();
+        const int32_t* neighbours  = context->input(Args::NEIGHBOURS).flat<tensorflow::int32>().data();
+        const int64_t n_points     = context->input(Args::FEATURES).shape().dim_size(0);
+        const int64_t depth        = context->input(Args::FEATURES).shape().dim_size(1);
+        const int64_t n_elems      = context->input(Args::NEIGHBOURS).shape().dim_size(0);
+        const int64_t n_neighbours = context->input(Args::NEIGHBOURS).shape().dim_size(1);
+
+        // Make sure every neighbour is a point we have features for
+        OP_REQUIRES(context,
+                    std::all_of(neighbours,
+                                neighbours + n_elems * n_neighbours,
+                                [&](const int32_t& n) { return 0 <= n && n < n_points; }),
+                    tensorflow::errors::InvalidArgument("The neighbours must all be indices of the features"));
+
+        // Create the output matrix to hold the gathered features
+        tensorflow::Tensor* gathered = nullptr;
+        tensorflow::TensorShape gathered_shape;
+        gathered_shape.AddDim(n_elems);
+        gathered_shape.AddDim(n_neighbours * depth);
+        OP_REQUIRES_OK(context, context->allocate_output(Outputs::GATHERED, gathered_shape, &gathered));
+
+        // Copy the features of each neighbour of each point into its row
+        T* out             = gathered->flat<T>().data();
+        const int64_t cost = COST * n_neighbours * depth;
+        const auto workers = context->device()->tensorflow_cpu_worker_threads();
+        tensorflow::Shard(workers->num_threads, workers->workers, n_elems, cost, [&](int64_t start, int64_t end) {
+            for (int64_t i = start; i < end; ++i) {
+                T* row = out + i * n_neighbours * depth;
+                for (int64_t j = 0; j < n_neighbours; ++j) {
+                    const T* in = features + neighbours[i * n_neighbours + j] * depth;
+                    row         = std::copy(in, in + depth, row);
+                }
+            }
+        });
+    }
+};
+
+/**
+ * @brief The gradient of the Visual Mesh graph convolution gather op
+ *
+ * @details
+ *  The gradient of the features of a point is the sum of the gradients of every place it was gathered into. Rather
+ *  than scattering the gradients, which would need the threads to synchronise, the neighbourhood graph is inverted so
+ *  that each point can add up its own gradients. This also means the sums are always made in the same order.
+ *
+ * @tparam T The scalar type used for floating point numbers
+ */
+template <typename T>
+class GatherVisualMeshGradOp : public tensorflow::OpKernel {
+public:
+    explicit GatherVisualMeshGradOp(tensorflow::OpKernelConstruction* context) : OpKernel(context) {}
+
+    /// Roughly how many cycles it takes to add a single value
+    static constexpr int64_t COST = 2;
+
+    void Compute(tensorflow::OpKernelContext* context) override {
+
+        // Check that the shape of each of the inputs is valid
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsMatrix(context->input(GradArgs::GRADIENTS).shape()),
+                    tensorflow::errors::InvalidArgument("The gradients must be an mx(k*d) matrix"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsMatrix(context->input(GradArgs::GRAD_NEIGHBOURS).shape()),
+                    tensorflow::errors::InvalidArgument("The neighbours must be an mxk matrix"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsScalar(context->input(GradArgs::N_POINTS).shape()),
+                    tensorflow::errors::InvalidArgument("The number of points must be a scalar"));
+
+        // Extract information from our input tensors
+        const T* gradients         = context->input(GradArgs::GRADIENTS).flat<T>().data();
+        const int32_t* neighbours  = context->input(GradArgs::GRAD_NEIGHBOURS).flat<tensorflow::int32>().data();
+        const int64_t n_points     = context->input(GradArgs::N_POINTS).scalar<tensorflow::int32>()(0);
+        const int64_t n_elems      = context->input(GradArgs::GRAD_NEIGHBOURS).shape().dim_size(0);
+        const int64_t n_neighbours = context->input(GradArgs::GRAD_NEIGHBOURS).shape().dim_size(1);
+        const int64_t width        = context->input(GradArgs::GRADIENTS).shape().dim_size(1);
+
+        OP_REQUIRES(context,
+                    context->input(GradArgs::GRADIENTS).shape().dim_size(0) == n_elems && n_neighbours > 0
+                      && width % n_neighbours == 0,
+                    tensorflow::errors::InvalidArgument("The gradients must have a row for each row of neighbours"));
+        OP_REQUIRES(context,
+                    std::all_of(neighbours,
+                                neighbours + n_elems * n_neighbours,
+                                [&](const int32_t& n) { return 0 <= n && n < n_points; }),
+                    tensorflow::errors::InvalidArgument("The neighbours must all be indices of the features"));
+        const int64_t depth = width / n_neighbours;
+
+        // Invert the graph so we have a list of the places each point was gathered into
+        std::vector<int64_t> offsets(n_points + 1, 0);
+        for (int64_t i = 0; i < n_elems * n_neighbours; ++i) {
+            ++offsets[neighbours[i] + 1];
+        }
+        for (int64_t p = 0; p < n_points; ++p) {
+            offsets[p + 1] += offsets[p];
+        }
+        std::vector<int64_t> sources(n_elems * n_neighbours);
+        {
+            std::vector<int64_t> next(offsets.begin(), offsets.end() - 1);
+            for (int64_t i = 0; i < n_elems * n_neighbours; ++i) {
+                sources[next[neighbours[i]]++] = i;
+            }
+        }
+
+        // Create the output matrix to hold the gradients of the features
+        tensorflow::Tensor* features = nullptr;
+        tensorflow::TensorShape features_shape;
+        features_shape.AddDim(n_points);
+        features_shape.AddDim(depth);
+        OP_REQUIRES_OK(context, context->allocate_output(Outputs::GATHERED, features_shape, &features));
+
+        // Add up the gradients for each point, a gathered value i came from row i / k at column (i % k) * d
+        T* out             = features->flat<T>().data();
+        const int64_t uses = std::max(int64_t(1), n_elems * n_neighbours / std::max(int64_t(1), n_points));
+        const int64_t cost = COST * depth * uses;
+        const auto workers = context->device()->tensorflow_cpu_worker_threads();
+        tensorflow::Shard(workers->num_threads, workers->workers, n_points, cost, [&](int64_t start, int64_t end) {
+            for (int64_t p = start; p < end; ++p) {
+                T* row = out + p * depth;
+                std::fill(row, row + depth, T(0));
+                for (int64_t s = offsets[p]; s < offsets[p + 1]; ++s) {
+                    const T* in = gradients + sources[s] * depth;
+                    for (int64_t d = 0; d < depth; ++d) {
+                        row[d] += in[d];
+                    }
+                }
+            }
+        });
+    }
+};
+
+// Register a version for float/double
+REGISTER_KERNEL_BUILDER(Name("GatherVisualMesh").Device(tensorflow::DEVICE_CPU).TypeConstraint<float>("T"),
+                        GatherVisualMeshOp<float>)
+REGISTER_KERNEL_BUILDER(Name("GatherVisualMesh").Device(tensorflow::DEVICE_CPU).TypeConstraint<double>("T"),
+                        GatherVisualMeshOp<double>)
+REGISTER_KERNEL_BUILDER(Name("GatherVisualMeshGrad").Device(tensorflow::DEVICE_CPU).TypeConstraint<float>("T"),
+                        GatherVisualMeshGradOp<float>)
+REGISTER_KERNEL_BUILDER(Name("GatherVisualMeshGrad").Device(tensorflow::DEVICE_CPU).TypeConstraint<double>("T"),
+                        GatherVisualMeshGradOp<double>)
@@ -19,19 +19,19 @@
 #include <tensorflow/core/framework/op_kernel.h>
 #include <tensorflow/core/framework/shape_inference.h>
 
-#include <array>
+#include <algorithm>
 #include <cstdint>
 #include <functional>
-#include <limits>
-#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "lookup.hpp"
 #include "mesh_cache.hpp"
 #include "model_op_base.hpp"
 #include "visualmesh/lens.hpp"
 #include "visualmesh/mesh.hpp"
+#include "visualmesh/prepared_lens.hpp"
 #include "visualmesh/utility/math.hpp"
 
 enum Args {
@@ -44,21 +44,24 @@ enum Args {
     HOC                    = 6,
     MESH_MODEL             = 7,
     CACHED_MESHES          = 8,
-    MAX_DISTANCE           = 9,
-    GEOMETRY               = 10,
-    RADIUS                 = 11,
-    N_INTERSECTIONS        = 12,
-    INTERSECTION_TOLERANCE = 13,
+    CACHE_BYTES            = 9,
+    MAX_DISTANCE           = 10,
+    GEOMETRY               = 11,
+    RADIUS                 = 12,
+    N_INTERSECTIONS        = 13,
+    INTERSECTION_TOLERANCE = 14,
 };
 
 enum Outputs {
     VECTORS    = 0,
     NEIGHBOURS = 1,
+    PIXELS     = 2,
 };
 
 REGISTER_OP("LookupVisualMesh")
   .Attr("T: {float, double}")
   .Attr("U: {int32, int64}")
+  .Attr("with_pixels: bool = false")
   .Input("image_dimensions: U")
   .Input("lens_projection: string")
   .Input("lens_focal_length: T")
@@ -68,6 +71,7 @@ REGISTER_OP("LookupVisualMesh")
   .Input("cam_to_observation_plane: T")
   .Input("mesh_model: string")
   .Input("cached_meshes: int32")
+  .Input("cache_bytes: int64")
   .Input("max_distance: T")
   .Input("geometry: string")
   .Input("radius: T")
@@ -75,10 +79,12 @@ REGISTER_OP("LookupVisualMesh")
   .Input("intersection_tolerance: T")
   .Output("vectors: T")
   .Output("neighbours: int32")
+  .Output("pixels: T")
   .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
-      // nx2 vectors on image, n+1xG neighbours (including off screen point), and n global indices
+      // nx3 vectors on image, nxG neighbours, and nx2 pixel coordinates if they were asked for
       c->set_output(Outputs::VECTORS, c->MakeShape({c->kUnknownDim, 3}));
       c->set_output(Outputs::NEIGHBOURS, c->MakeShape({c->kUnknownDim, c->kUnknownDim}));
+      c->set_output(Outputs::PIXELS, c->MakeShape({c->kUnknownDim, 2}));
       return tensorflow::Status::OK();
   });
 
@@ -89,6 +95,9 @@ REGISTER_OP("LookupVisualMesh")
  *  This op will perform a projection using the visual mesh and will return the neighbourhood graph and the pixel
  * coordinates for the points that would be on screen for the lens paramters provided.
  *
+ *  The pixel coordinates are only calculated if the with_pixels attribute is set, otherwise they are empty. They are
+ *  found using the projections that the lookup already made to find which points are on screen.
+ *
  * @tparam T The scalar type used for floating point numbers
  * @tparam U The scalar type used for integer numbers
  */
@@ -97,7 +106,9 @@ class LookupVisualMeshOp
   : public ModelOpBase<T, LookupVisualMeshOp<T, U>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS> {
 public:
     explicit LookupVisualMeshOp(tensorflow::OpKernelConstruction* context)
-      : ModelOpBase<T, LookupVisualMeshOp<T, U>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS>(context) {}
+      : ModelOpBase<T, LookupVisualMeshOp<T, U>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS>(context) {
+        OP_REQUIRES_OK(context, context->GetAttr("with_pixels", &with_pixels));
+    }
 
     template <template <typename> class Model, typename Shape>
     void DoCompute(tensorflow::OpKernelContext* context, const Shape& shape) {
@@ -132,6 +143,9 @@ public:
         OP_REQUIRES(context,
                     tensorflow::TensorShapeUtils::IsScalar(context->input(Args::CACHED_MESHES).shape()),
                     tensorflow::errors::InvalidArgument("The number cached meshes must be a scalar"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsScalar(context->input(Args::CACHE_BYTES).shape()),
+                    tensorflow::errors::InvalidArgument("The number of bytes to cache must be a scalar"));
         OP_REQUIRES(context,
                     tensorflow::TensorShapeUtils::IsScalar(context->input(Args::INTERSECTION_TOLERANCE).shape()),
                     tensorflow::errors::InvalidArgument("The intersection tolerance must be a scalar"));
@@ -139,19 +153,15 @@ public:
                     tensorflow::TensorShapeUtils::IsScalar(context->input(Args::MAX_DISTANCE).shape()),
                     tensorflow::errors::InvalidArgument("The maximum distance must be a scalar"));
 
-        // Extract information from our input tensors, flip x and y as tensorflow has them reversed compared to us
-        auto image_dimensions                = context->input(Args::DIMENSIONS).vec<U>();
-        visualmesh::vec2<int32_t> dimensions = {{int32_t(image_dimensions(1)), int32_t(image_dimensions(0))}};
-        std::string projection               = *context->input(Args::PROJECTION).flat<tensorflow::tstring>().data();
-        T focal_length                       = context->input(Args::FOCAL_LENGTH).scalar<T>()(0);
-        auto lens_centre                     = context->input(Args::LENS_CENTRE).flat<T>();
-        auto lens_distortion                 = context->input(Args::LENS_DISTORTION).flat<T>();
-        T fov                                = context->input(Args::FIELD_OF_VIEW).scalar<T>()(0);
-        auto tHoc                            = context->input(Args::HOC).matrix<T>();
-        T max_distance                       = context->input(Args::MAX_DISTANCE).scalar<T>()(0);
-        T n_intersections                    = context->input(Args::N_INTERSECTIONS).scalar<T>()(0);
-        tensorflow::int32 cached_meshes      = context->input(Args::CACHED_MESHES).scalar<tensorflow::int32>()(0);
-        T intersection_tolerance             = context->input(Args::INTERSECTION_TOLERANCE).scalar<T>()(0);
+        // Extract information from our input tensors
+        std::string projection          = *context->input(Args::PROJECTION).flat<tensorflow::tstring>().data();
+        T focal_length                  = context->input(Args::FOCAL_LENGTH).scalar<T>()(0);
+        T fov                           = context->input(Args::FIELD_OF_VIEW).scalar<T>()(0);
+        T max_distance                  = context->input(Args::MAX_DISTANCE).scalar<T>()(0);
+        T n_intersections               = context->input(Args::N_INTERSECTIONS).scalar<T>()(0);
+        tensorflow::int32 cached_meshes = context->input(Args::CACHED_MESHES).scalar<tensorflow::int32>()(0);
+        tensorflow::int64 cache_bytes   = context->input(Args::CACHE_BYTES).scalar<tensorflow::int64>()(0);
+        T intersection_tolerance        = context->input(Args::INTERSECTION_TOLERANCE).scalar<T>()(0);
 
         // Perform some runtime checks on the actual values to make sure they make sense
         OP_REQUIRES(
@@ -159,41 +169,32 @@ public:
           projection == "EQUISOLID" || projection == "EQUIDISTANT" || projection == "RECTILINEAR",
           tensorflow::errors::InvalidArgument("Projection must be one of EQUISOLID, EQUIDISTANT or RECTILINEAR"));
 
-        // Create our transformation matrix
-        visualmesh::mat4<T> Hoc = {{
-          visualmesh::vec4<T>{tHoc(0, 0), tHoc(0, 1), tHoc(0, 2), tHoc(0, 3)},
-          visualmesh::vec4<T>{tHoc(1, 0), tHoc(1, 1), tHoc(1, 2), tHoc(1, 3)},
-          visualmesh::vec4<T>{tHoc(2, 0), tHoc(2, 1), tHoc(2, 2), tHoc(2, 3)},
-          visualmesh::vec4<T>{tHoc(3, 0), tHoc(3, 1), tHoc(3, 2), tHoc(3, 3)},
-        }};
-
-        // Create our lens
-        visualmesh::Lens<T> lens;
-        lens.dimensions   = dimensions;
-        lens.focal_length = focal_length;
-        lens.centre       = {{lens_centre(1), lens_centre(0)}};  // Swap from tf coordinates to our coordinates
-        lens.k            = {{lens_distortion(0), lens_distortion(1)}};
-        lens.fov          = fov;
-
-        // clang-format off
-        if (projection == "EQUISOLID") lens.projection = visualmesh::EQUISOLID;
-        else if (projection == "EQUIDISTANT") lens.projection = visualmesh::EQUIDISTANT;
-        else if (projection == "RECTILINEAR") lens.projection = visualmesh::RECTILINEAR;
-        // clang-format on
-
-        // Get a mesh that matches from the mesh cache
-        std::shared_ptr<visualmesh::Mesh<T, Model>> mesh =
-          get_mesh<T, Model>(shape, Hoc[2][3], n_intersections, intersection_tolerance, cached_meshes, max_distance);
-
-        // Grab the ranges
-        auto ranges       = mesh->lookup(Hoc, lens);
-        const auto& nodes = mesh->nodes;
-
-        // Work out how many points total there are in the ranges
-        unsigned int n_points = 0;
-        for (auto& r : ranges) {
-            n_points += r.second - r.first;
-        }
+        // Create our transformation matrix and lens
+        visualmesh::mat4<T> Hoc  = make_Hoc(context->input(Args::HOC).flat<T>().data());
+        visualmesh::Lens<T> lens = make_lens(context->input(Args::DIMENSIONS).flat<U>().data(),
+                                             projection,
+                                             focal_length,
+                                             context->input(Args::LENS_CENTRE).flat<T>().data(),
+                                             context->input(Args::LENS_DISTORTION).flat<T>().data(),
+                                             fov);
+
+        // Get a mesh that matches from the mesh cache, generating it with no more threads than the intra op thread pool
+        // so we don't compete with the rest of the graph
+        const int threads = context->device()->tensorflow_cpu_worker_threads()->num_threads;
+        std::shared_ptr<const visualmesh::Mesh<T, Model>> mesh = get_mesh<T, Model>(shape,
+                                                                                    Hoc[2][3],
+                                                                                    n_intersections,
+                                                                                    intersection_tolerance,
+                                                                                    cached_meshes,
+                                                                                    max_distance,
+                                                                                    cache_bytes,
+                                                                                    std::max(threads, 1));
+
+        // Grab the ranges, along with the pixel coordinates of the points in them if we need them
+        const visualmesh::PreparedLens<T> prepared(lens);
+        std::vector<visualmesh::vec2<T>> pixels;
+        auto ranges  = with_pixels ? lookup_pixels(*mesh, Hoc, prepared, pixels) : mesh->lookup(Hoc, prepared);
+        int n_points = count_points(ranges);
 
         // Allocate our outputs
         tensorflow::Tensor* vectors = nullptr;
@@ -208,44 +209,20 @@ public:
         neighbours_shape.AddDim(Model<T>::N_NEIGHBOURS + 1);
         OP_REQUIRES_OK(context, context->allocate_output(Outputs::NEIGHBOURS, neighbours_shape, &neighbours));
 
-        // Build the lookup for the graph so we can find the new location of points
-        std::vector<int> r_lookup(nodes.size() + 1, std::numeric_limits<tensorflow::int32>::lowest());
-        {
-            int idx = 0;
-            for (const auto& r : ranges) {
-                for (int i = r.first; i < r.second; ++i) {
-                    r_lookup[i] = idx++;
-                }
-            }
-        }
-
-        // Copy across the unit vectors we looked up
-        {
-            auto v  = vectors->matrix<T>();
-            auto n  = neighbours->matrix<tensorflow::int32>();
-            int idx = 0;
-            for (const auto& r : ranges) {
-                for (int i = r.first; i < r.second; ++i) {
+        tensorflow::Tensor* coordinates = nullptr;
+        tensorflow::TensorShape coordinates_shape;
+        coordinates_shape.AddDim(pixels.size());
+        coordinates_shape.AddDim(2);
+        OP_REQUIRES_OK(context, context->allocate_output(Outputs::PIXELS, coordinates_shape, &coordinates));
 
-                    // Copy across the ray
-                    const auto& r = nodes[i].ray;
-                    v(idx, 0)     = r[0];
-                    v(idx, 1)     = r[1];
-                    v(idx, 2)     = r[2];
-
-                    // Copy across the graph points in their new position
-                    const auto& node = nodes[i];
-                    n(idx, 0)        = idx;
-                    for (int j = 0; j < Model<T>::N_NEIGHBOURS; ++j) {
-                        n(idx, j + 1) = r_lookup[node.neighbours[j]];
-                    }
-
-                    // Next value to fill
-                    ++idx;
-                }
-            }
-        }
+        // Copy across the unit vectors, graph and pixel coordinates we looked up
+        copy_lookup(*mesh, ranges, vectors->flat<T>().data(), neighbours->flat<tensorflow::int32>().data());
+        copy_pixels(pixels, coordinates->flat<T>().data());
     }
+
+private:
+    /// If the pixel coordinates of the points should be calculated
+    bool with_pixels;
 };
 
 // Register a version for all the combinations of float/double and int32/int64
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef VISUALMESH_TENSORFLOW_LOOKUP_HPP
+#define VISUALMESH_TENSORFLOW_LOOKUP_HPP
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "visualmesh/lens.hpp"
+#include "visualmesh/mesh.hpp"
+#include "visualmesh/prepared_lens.hpp"
+#include "visualmesh/utility/math.hpp"
+
+/**
+ * @brief Create a lens from the values given to a lookup op
+ *
+ * @tparam T the scalar type used for floating point numbers
+ * @tparam U the scalar type used for integer numbers
+ *
+ * @param dimensions   the image dimensions as [y_size, x_size]
+ * @param projection   the name of the lens projection, which must be one of EQUISOLID, EQUIDISTANT or RECTILINEAR
+ * @param focal_length the focal length of the lens in pixels
+ * @param centre       the offset of the lens axis from the centre of the image as [y, x]
+ * @param distortion   the two distortion coefficients of the lens
+ * @param fov          the field of view of the lens
+ *
+ * @return the lens in our coordinates, with x and y swapped from tensorflow's
+ */
+template <typename T, typename U>
+visualmesh::Lens<T> make_lens(const U* dimensions,
+                              const std::string& projection,
+                              const T& focal_length,
+                              const T* centre,
+                              const T* distortion,
+                              const T& fov) {
+    visualmesh::Lens<T> lens;
+    lens.dimensions   = {{int32_t(dimensions[1]), int32_t(dimensions[0])}};
+    lens.focal_length = focal_length;
+    lens.centre       = {{centre[1], centre[0]}};
+    lens.k            = {{distortion[0], distortion[1]}};
+    lens.fov          = fov;
+
+    // clang-format off
+    if (projection == "EQUISOLID") lens.projection = visualmesh::EQUISOLID;
+    else if (projection == "EQUIDISTANT") lens.projection = visualmesh::EQUIDISTANT;
+    else if (projection == "RECTILINEAR") lens.projection = visualmesh::RECTILINEAR;
+    // clang-format on
+
+    return lens;
+}
+
+/**
+ * @brief Create Hoc from the 16 values of a row major 4x4 matrix
+ */
+template <typename T>
+visualmesh::mat4<T> make_Hoc(const T* tHoc) {
+    return {{
+      visualmesh::vec4<T>{tHoc[0], tHoc[1], tHoc[2], tHoc[3]},
+      visualmesh::vec4<T>{tHoc[4], tHoc[5], tHoc[6], tHoc[7]},
+      visualmesh::vec4<T>{tHoc[8], tHoc[9], tHoc[10], tHoc[11]},
+      visualmesh::vec4<T>{tHoc[12], tHoc[13], tHoc[14], tHoc[15]},
+    }};
+}
+
+/// Work out how many points there are in total in a list of ranges
+inline int count_points(const std::vector<std::pair<int, int>>& ranges) {
+    int n_points = 0;
+    for (const auto& r : ranges) {
+        n_points += r.second - r.first;
+    }
+    return n_points;
+}
+
+/**
+ * @brief Lookup which ranges of a mesh are on screen and find the pixel coordinates of the points in them
+ *
+ * @details
+ *  The lookup already projects many of the points to find out if they are on screen, so only the points that it did
+ *  not project are projected afterwards. The pixel coordinates are the same as projecting every point.
+ *
+ * @tparam T     the scalar type used for floating point numbers
+ * @tparam Model the mesh model that the mesh was generated with
+ *
+ * @param mesh   the mesh to lookup
+ * @param Hoc    the homogenous transformation matrix from the camera to the observation plane
+ * @param lens   the lens that we are projecting with
+ * @param pixels filled with the pixel coordinates of each of the points in the ranges in order
+ *
+ * @return pairs of start/end ranges that are the points which are on the screen
+ */
+template <typename T, template <typename> class Model>
+std::vector<std::pair<int, int>> lookup_pixels(const visualmesh::Mesh<T, Model>& mesh,
+                                               const visualmesh::mat4<T>& Hoc,
+                                               const visualmesh::PreparedLens<T>& lens,
+                                               std::vector<visualmesh::vec2<T>>& pixels) {
+    // Each lookup is for a different camera so there is nothing for a cache to reuse
+    std::vector<visualmesh::vec2<T>> projected;
+    const auto segments = mesh.lookup(Hoc, lens, projected);
+
+    const visualmesh::mat3<T> Rco(visualmesh::block<3, 3>(visualmesh::transpose(Hoc)));
+    std::vector<std::pair<int, int>> ranges;
+    std::vector<T> rays;
+    ranges.reserve(segments.size());
+    pixels.clear();
+    for (const auto& s : segments) {
+        const int n = s.range.second - s.range.first;
+        ranges.push_back(s.range);
+
+        // Take the pixel coordinates the lookup already has, otherwise rotate the rays into the camera and project them
+        if (s.pixels >= 0) {
+            pixels.insert(pixels.end(), projected.begin() + s.pixels, projected.begin() + s.pixels + n);
+        }
+        else {
+            rays.resize(n * 3);
+            T* x = rays.data();
+            T* y = x + n;
+            T* z = y + n;
+            for (int i = 0; i < n; ++i) {
+                const visualmesh::vec3<T> ray = visualmesh::multiply(Rco, mesh.ray(s.range.first + i));
+                x[i]                          = ray[0];
+                y[i]                          = ray[1];
+                z[i]                          = ray[2];
+            }
+            pixels.resize(pixels.size() + n);
+            visualmesh::project(x, y, z, n, lens, pixels.data() + pixels.size() - n);
+        }
+    }
+
+    return ranges;
+}
+
+/**
+ * @brief Copy out pixel coordinates, swapping x and y to the order that tensorflow uses
+ *
+ * @param pixels      the pixel coordinates as [x, y]
+ * @param coordinates where to write the n_points x 2 pixel coordinates as [y, x]
+ */
+template <typename T>
+void copy_pixels(const std::vector<visualmesh::vec2<T>>& pixels, T* coordinates) {
+    for (unsigned int i = 0; i < pixels.size(); ++i) {
+        coordinates[i * 2 + 0] = pixels[i][1];
+        coordinates[i * 2 + 1] = pixels[i][0];
+    }
+}
+
+/**
+ * @brief Copy out the unit vectors and neighbourhood graph of the points that a lookup found on screen
+ *
+ * @details
+ *  The first column of the graph is the index of the point itself, and is followed by the index of each of its
+ *  neighbours within the points that are on screen. Neighbours that are not on screen are given the lowest int32 value.
+ *
+ * @tparam T     the scalar type used for floating point numbers
+ * @tparam Model the mesh model that the mesh was generated with
+ *
+ * @param mesh       the mesh that was looked up
+ * @param ranges     the ranges of the mesh that the lookup found on screen
+ * @param vectors    where to write the n_points x 3 unit vectors
+ * @param neighbours where to write the n_points x (N_NEIGHBOURS + 1) neighbourhood graph
+ */
+template <typename T, template <typename> class Model>
+void copy_lookup(const visualmesh::Mesh<T, Model>& mesh,
+                 const std::vector<std::pair<int, int>>& ranges,
+                 T* vectors,
+                 int32_t* neighbours) {
+    constexpr int N_NEIGHBOURS = Model<T>::N_NEIGHBOURS;
+
+    // Build the lookup for the graph so we can find the new location of points
+    std::vector<int32_t> r_lookup(mesh.size() + 1, std::numeric_limits<int32_t>::lowest());
+    {
+        int idx = 0;
+        for (const auto& r : ranges) {
+            for (int i = r.first; i < r.second; ++i) {
+                r_lookup[i] = idx++;
+            }
+        }
+    }
+
+    // Copy across the unit vectors we looked up
+    int idx = 0;
+    for (const auto& r : ranges) {
+        for (int i = r.first; i < r.second; ++i) {
+
+            // Copy across the ray
+            const auto ray       = mesh.ray(i);
+            vectors[idx * 3 + 0] = ray[0];
+            vectors[idx * 3 + 1] = ray[1];
+            vectors[idx * 3 + 2] = ray[2];
+
+            // Copy across the graph points in their new position
+            const auto node = mesh.neighbours(i);
+            int32_t* n      = &neighbours[idx * (N_NEIGHBOURS + 1)];
+            n[0]            = idx;
+            for (int j = 0; j < N_NEIGHBOURS; ++j) {
+                n[j + 1] = r_lookup[node[j]];
+            }
+
+            // Next value to fill
+            ++idx;
+        }
+    }
+}
+
+#endif  // VISUALMESH_TENSORFLOW_LOOKUP_HPP
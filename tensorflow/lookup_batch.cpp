@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <tensorflow/core/framework/op.h>
+#include <tensorflow/core/framework/op_kernel.h>
+#include <tensorflow/core/framework/shape_inference.h>
+#include <tensorflow/core/util/work_sharder.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lookup.hpp"
+#include "mesh_cache.hpp"
+#include "model_op_base.hpp"
+#include "visualmesh/lens.hpp"
+#include "visualmesh/mesh.hpp"
+#include "visualmesh/prepared_lens.hpp"
+#include "visualmesh/utility/math.hpp"
+
+enum Args {
+    DIMENSIONS             = 0,
+    PROJECTION             = 1,
+    FOCAL_LENGTH           = 2,
+    LENS_CENTRE            = 3,
+    LENS_DISTORTION        = 4,
+    FIELD_OF_VIEW          = 5,
+    HOC                    = 6,
+    MESH_MODEL             = 7,
+    CACHED_MESHES          = 8,
+    CACHE_BYTES            = 9,
+    MAX_DISTANCE           = 10,
+    GEOMETRY               = 11,
+    RADIUS                 = 12,
+    N_INTERSECTIONS        = 13,
+    INTERSECTION_TOLERANCE = 14,
+};
+
+enum Outputs {
+    VECTORS    = 0,
+    NEIGHBOURS = 1,
+    ROW_SPLITS = 2,
+    PIXELS     = 3,
+};
+
+REGISTER_OP("LookupVisualMeshBatch")
+  .Attr("T: {float, double}")
+  .Attr("U: {int32, int64}")
+  .Attr("with_pixels: bool = false")
+  .Input("image_dimensions: U")
+  .Input("lens_projection: string")
+  .Input("lens_focal_length: T")
+  .Input("lens_centre: T")
+  .Input("lens_distortion: T")
+  .Input("lens_fov: T")
+  .Input("cam_to_observation_plane: T")
+  .Input("mesh_model: string")
+  .Input("cached_meshes: int32")
+  .Input("cache_bytes: int64")
+  .Input("max_distance: T")
+  .Input("geometry: string")
+  .Input("radius: T")
+  .Input("n_intersections: T")
+  .Input("intersection_tolerance: T")
+  .Output("vectors: T")
+  .Output("neighbours: int32")
+  .Output("row_splits: int64")
+  .Output("pixels: T")
+  .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      // nx3 vectors for every image, nxG neighbours, b+1 row splits saying which rows belong to each image, and nx2
+      // pixel coordinates if they were asked for
+      tensorflow::shape_inference::DimensionHandle n_splits;
+      TF_RETURN_IF_ERROR(c->Add(c->Dim(c->input(Args::DIMENSIONS), 0), 1, &n_splits));
+      c->set_output(Outputs::VECTORS, c->MakeShape({c->kUnknownDim, 3}));
+      c->set_output(Outputs::NEIGHBOURS, c->MakeShape({c->kUnknownDim, c->kUnknownDim}));
+      c->set_output(Outputs::ROW_SPLITS, c->Vector(n_splits));
+      c->set_output(Outputs::PIXELS, c->MakeShape({c->kUnknownDim, 2}));
+      return tensorflow::Status::OK();
+  });
+
+/**
+ * @brief The Visual Mesh projection op for a batch of images
+ *
+ * @details
+ *  This op performs the same lookup as LookupVisualMesh for every image in a batch, with the lens and Hoc inputs
+ *  stacked along their first dimension. The images are looked up in parallel and their results are concatenated, with
+ *  the row splits giving the start and end of the rows for each image. The neighbourhood graph of each image indexes
+ *  the points of that image in the same way as LookupVisualMesh does, so the outputs can be used as ragged tensors. As
+ *  with LookupVisualMesh the pixel coordinates are only calculated if the with_pixels attribute is set.
+ *
+ * @tparam T The scalar type used for floating point numbers
+ * @tparam U The scalar type used for integer numbers
+ */
+template <typename T, typename U>
+class LookupVisualMeshBatchOp
+  : public ModelOpBase<T, LookupVisualMeshBatchOp<T, U>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS> {
+public:
+    explicit LookupVisualMeshBatchOp(tensorflow::OpKernelConstruction* context)
+      : ModelOpBase<T, LookupVisualMeshBatchOp<T, U>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS>(context) {
+        OP_REQUIRES_OK(context, context->GetAttr("with_pixels", &with_pixels));
+    }
+
+    /// Roughly how many cycles it takes to lookup a single image, which dwarfs the cost of sharding them
+    static constexpr int64_t LOOKUP_COST = 1000000;
+    /// Roughly how many cycles it takes to copy out a single point
+    static constexpr int64_t COPY_COST = 50;
+
+    template <template <typename> class Model, typename Shape>
+    void DoCompute(tensorflow::OpKernelContext* context, const Shape& shape) {
+
+        // Check that the shape of each of the inputs is valid
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsMatrix(context->input(Args::DIMENSIONS).shape())
+                      && context->input(Args::DIMENSIONS).shape().dim_size(1) == 2,
+                    tensorflow::errors::InvalidArgument("The image dimensions must be a bx2 matrix of [y, x] sizes"));
+        const int64_t n_images = context->input(Args::DIMENSIONS).shape().dim_size(0);
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsVector(context->input(Args::PROJECTION).shape())
+                      && context->input(Args::PROJECTION).shape().dim_size(0) == n_images,
+                    tensorflow::errors::InvalidArgument("The projections must be a vector with one for each image"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsVector(context->input(Args::FOCAL_LENGTH).shape())
+                      && context->input(Args::FOCAL_LENGTH).shape().dim_size(0) == n_images,
+                    tensorflow::errors::InvalidArgument("The focal lengths must be a vector with one for each image"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsMatrix(context->input(Args::LENS_CENTRE).shape())
+                      && context->input(Args::LENS_CENTRE).shape().dim_size(0) == n_images
+                      && context->input(Args::LENS_CENTRE).shape().dim_size(1) == 2,
+                    tensorflow::errors::InvalidArgument("The lens centres must be a bx2 matrix of [y_size, x_size]"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsMatrix(context->input(Args::LENS_DISTORTION).shape())
+                      && context->input(Args::LENS_DISTORTION).shape().dim_size(0) == n_images
+                      && context->input(Args::LENS_DISTORTION).shape().dim_size(1) == 2,
+                    tensorflow::errors::InvalidArgument("The lens distortions must be a bx2 matrix"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsVector(context->input(Args::FIELD_OF_VIEW).shape())
+                      && context->input(Args::FIELD_OF_VIEW).shape().dim_size(0) == n_images,
+                    tensorflow::errors::InvalidArgument("The fields of view must be a vector with one for each image"));
+        OP_REQUIRES(context,
+                    context->input(Args::HOC).shape().dims() == 3
+                      && context->input(Args::HOC).shape().dim_size(0) == n_images
+                      && context->input(Args::HOC).shape().dim_size(1) == 4
+                      && context->input(Args::HOC).shape().dim_size(2) == 4,
+                    tensorflow::errors::InvalidArgument("Hoc must be a bx4x4 tensor"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsScalar(context->input(Args::N_INTERSECTIONS).shape()),
+                    tensorflow::errors::InvalidArgument("The number of intersections must be a scalar"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsScalar(context->input(Args::CACHED_MESHES).shape()),
+                    tensorflow::errors::InvalidArgument("The number cached meshes must be a scalar"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsScalar(context->input(Args::CACHE_BYTES).shape()),
+                    tensorflow::errors::InvalidArgument("The number of bytes to cache must be a scalar"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsScalar(context->input(Args::INTERSECTION_TOLERANCE).shape()),
+                    tensorflow::errors::InvalidArgument("The intersection tolerance must be a scalar"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsScalar(context->input(Args::MAX_DISTANCE).shape()),
+                    tensorflow::errors::InvalidArgument("The maximum distance must be a scalar"));
+
+        // Extract information from our input tensors
+        auto dimensions                 = context->input(Args::DIMENSIONS).matrix<U>();
+        auto projections                = context->input(Args::PROJECTION).vec<tensorflow::tstring>();
+        auto focal_lengths              = context->input(Args::FOCAL_LENGTH).vec<T>();
+        auto lens_centres               = context->input(Args::LENS_CENTRE).matrix<T>();
+        auto lens_distortions           = context->input(Args::LENS_DISTORTION).matrix<T>();
+        auto fovs                       = context->input(Args::FIELD_OF_VIEW).vec<T>();
+        auto tHoc                       = context->input(Args::HOC).tensor<T, 3>();
+        T max_distance                  = context->input(Args::MAX_DISTANCE).scalar<T>()(0);
+        T n_intersections               = context->input(Args::N_INTERSECTIONS).scalar<T>()(0);
+        tensorflow::int32 cached_meshes = context->input(Args::CACHED_MESHES).scalar<tensorflow::int32>()(0);
+        tensorflow::int64 cache_bytes   = context->input(Args::CACHE_BYTES).scalar<tensorflow::int64>()(0);
+        T intersection_tolerance        = context->input(Args::INTERSECTION_TOLERANCE).scalar<T>()(0);
+
+        // Create the transformation matrix and lens for each image, checking that the projections make sense
+        std::vector<visualmesh::mat4<T>> Hocs;
+        std::vector<visualmesh::Lens<T>> lenses;
+        Hocs.reserve(n_images);
+        lenses.reserve(n_images);
+        for (int64_t b = 0; b < n_images; ++b) {
+            const std::string projection = projections(b);
+            OP_REQUIRES(
+              context,
+              projection == "EQUISOLID" || projection == "EQUIDISTANT" || projection == "RECTILINEAR",
+              tensorflow::errors::InvalidArgument("Projection must be one of EQUISOLID, EQUIDISTANT or RECTILINEAR"));
+
+            Hocs.push_back(make_Hoc(&tHoc(b, 0, 0)));
+            lenses.push_back(make_lens(
+              &dimensions(b, 0), projection, focal_lengths(b), &lens_centres(b, 0), &lens_distortions(b, 0), fovs(b)));
+        }
+
+        // Lookup each of the images in parallel, the mesh cache makes sure each mesh is only generated once. Each mesh
+        // is generated on a single thread as we are already running on every thread in the intra op thread pool
+        const auto workers = context->device()->tensorflow_cpu_worker_threads();
+        std::vector<std::shared_ptr<const visualmesh::Mesh<T, Model>>> meshes(n_images);
+        std::vector<std::vector<std::pair<int, int>>> ranges(n_images);
+        std::vector<std::vector<visualmesh::vec2<T>>> pixels(n_images);
+        tensorflow::Shard(
+          workers->num_threads, workers->workers, n_images, LOOKUP_COST, [&](int64_t start, int64_t end) {
+              for (int64_t b = start; b < end; ++b) {
+                  meshes[b] = get_mesh<T, Model>(shape,
+                                                 Hocs[b][2][3],
+                                                 n_intersections,
+                                                 intersection_tolerance,
+                                                 cached_meshes,
+                                                 max_distance,
+                                                 cache_bytes,
+                                                 1);
+                  const visualmesh::PreparedLens<T> prepared(lenses[b]);
+                  ranges[b] = with_pixels ? lookup_pixels(*meshes[b], Hocs[b], prepared, pixels[b])
+                                          : meshes[b]->lookup(Hocs[b], prepared);
+              }
+          });
+
+        // Work out where the points for each image start
+        tensorflow::Tensor* row_splits = nullptr;
+        tensorflow::TensorShape row_splits_shape;
+        row_splits_shape.AddDim(n_images + 1);
+        OP_REQUIRES_OK(context, context->allocate_output(Outputs::ROW_SPLITS, row_splits_shape, &row_splits));
+        auto splits = row_splits->vec<tensorflow::int64>();
+        splits(0)   = 0;
+        for (int64_t b = 0; b < n_images; ++b) {
+            splits(b + 1) = splits(b) + count_points(ranges[b]);
+        }
+        const int64_t n_points = splits(n_images);
+
+        // Allocate our outputs
+        tensorflow::Tensor* vectors = nullptr;
+        tensorflow::TensorShape vectors_shape;
+        vectors_shape.AddDim(n_points);
+        vectors_shape.AddDim(3);
+        OP_REQUIRES_OK(context, context->allocate_output(Outputs::VECTORS, vectors_shape, &vectors));
+
+        tensorflow::Tensor* neighbours = nullptr;
+        tensorflow::TensorShape neighbours_shape;
+        neighbours_shape.AddDim(n_points);
+        neighbours_shape.AddDim(Model<T>::N_NEIGHBOURS + 1);
+        OP_REQUIRES_OK(context, context->allocate_output(Outputs::NEIGHBOURS, neighbours_shape, &neighbours));
+
+        tensorflow::Tensor* coordinates = nullptr;
+        tensorflow::TensorShape coordinates_shape;
+        coordinates_shape.AddDim(with_pixels ? n_points : 0);
+        coordinates_shape.AddDim(2);
+        OP_REQUIRES_OK(context, context->allocate_output(Outputs::PIXELS, coordinates_shape, &coordinates));
+
+        // Copy across the unit vectors, graph and pixel coordinates for each image in parallel
+        T* v                    = vectors->flat<T>().data();
+        tensorflow::int32* n    = neighbours->flat<tensorflow::int32>().data();
+        T* c                    = coordinates->flat<T>().data();
+        const int64_t copy_cost = COPY_COST * std::max(int64_t(1), n_points / std::max(int64_t(1), n_images));
+        tensorflow::Shard(workers->num_threads, workers->workers, n_images, copy_cost, [&](int64_t start, int64_t end) {
+            for (int64_t b = start; b < end; ++b) {
+                copy_lookup(*meshes[b], ranges[b], v + splits(b) * 3, n + splits(b) * (Model<T>::N_NEIGHBOURS + 1));
+                copy_pixels(pixels[b], c + splits(b) * 2);
+            }
+        });
+    }
+
+private:
+    /// If the pixel coordinates of the points should be calculated
+    bool with_pixels;
+};
+
+// Register a version for all the combinations of float/double and int32/int64
+REGISTER_KERNEL_BUILDER(Name("LookupVisualMeshBatch")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<float>("T")
+                          .TypeConstraint<tensorflow::int32>("U"),
+                        LookupVisualMeshBatchOp<float, tensorflow::int32>)
+REGISTER_KERNEL_BUILDER(Name("LookupVisualMeshBatch")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<float>("T")
+                          .TypeConstraint<tensorflow::int64>("U"),
+                        LookupVisualMeshBatchOp<float, tensorflow::int64>)
+REGISTER_KERNEL_BUILDER(Name("LookupVisualMeshBatch")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<double>("T")
+                          .TypeConstraint<tensorflow::int32>("U"),
+                        LookupVisualMeshBatchOp<double, tensorflow::int32>)
+REGISTER_KERNEL_BUILDER(Name("LookupVisualMeshBatch")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<double>("T")
+                          .TypeConstraint<tensorflow::int64>("U"),
+                        LookupVisualMeshBatchOp<double, tensorflow::int64>)
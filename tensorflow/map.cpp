@@ -18,11 +18,15 @@
 #include <tensorflow/core/framework/op.h>
 #include <tensorflow/core/framework/op_kernel.h>
 #include <tensorflow/core/framework/shape_inference.h>
+#include <tensorflow/core/util/work_sharder.h>
 
 #include <cmath>
+#include <cstdint>
 #include <functional>
+#include <vector>
 
 #include "model_op_base.hpp"
+#include "visualmesh/model/map_batch.hpp"
 #include "visualmesh/utility/math.hpp"
 
 enum Args {
@@ -65,6 +69,9 @@ public:
     explicit MapVisualMeshOp(tensorflow::OpKernelConstruction* context)
       : ModelOpBase<T, MapVisualMeshOp<T>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS>(context) {}
 
+    /// Roughly how many cycles it takes to map a single coordinate, solving the nm grid maps takes the longest
+    static constexpr int64_t COST = 5000;
+
     template <template <typename> class Model, typename Shape>
     void DoCompute(tensorflow::OpKernelContext* context, const Shape& shape) {
 
@@ -89,15 +96,24 @@ public:
         vectors_shape.AddDim(3);
         OP_REQUIRES_OK(context, context->allocate_output(Outputs::VECTORS, vectors_shape, &vectors));
 
-        // Perform the map operation for this shape
-        auto vs = vectors->matrix<T>();
-        for (int i = 0; i < n_elems; ++i) {
-            visualmesh::vec3<T> v = visualmesh::normalise(
-              Model<T>::map(shape, height, visualmesh::vec2<T>({coordinates(i, 0), coordinates(i, 1)})));
-            vs(i, 0) = v[0];
-            vs(i, 1) = v[1];
-            vs(i, 2) = v[2];
-        }
+        // Perform the map operation for this shape, splitting the coordinates over the intra op thread pool
+        auto vs            = vectors->matrix<T>();
+        const auto workers = context->device()->tensorflow_cpu_worker_threads();
+        tensorflow::Shard(workers->num_threads, workers->workers, n_elems, COST, [&](int64_t start, int64_t end) {
+            std::vector<visualmesh::vec2<T>> nm(end - start);
+            for (int64_t i = start; i < end; ++i) {
+                nm[i - start] = visualmesh::vec2<T>({coordinates(i, 0), coordinates(i, 1)});
+            }
+            std::vector<visualmesh::vec3<T>> mapped(end - start);
+            visualmesh::model::map_batch<Model<T>>(shape, height, nm.data(), end - start, mapped.data());
+
+            for (int64_t i = start; i < end; ++i) {
+                visualmesh::vec3<T> v = visualmesh::normalise(mapped[i - start]);
+                vs(i, 0)              = v[0];
+                vs(i, 1)              = v[1];
+                vs(i, 2)              = v[2];
+            }
+        });
     }
 };
 
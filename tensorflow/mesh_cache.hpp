@@ -18,9 +18,15 @@
 #ifndef VISUALMESH_TENSORFLOW_MESH_CACHE_HPP
 #define VISUALMESH_TENSORFLOW_MESH_CACHE_HPP
 
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
 #include <mutex>
-#include <vector>
+#include <tuple>
 
 #include "visualmesh/mesh.hpp"
 
@@ -44,55 +50,142 @@ Scalar mesh_k_error(const Shape<Scalar>& shape, const Scalar& h_0, const Scalar&
 }
 
 /**
- * @brief Lookup an appropriate Visual Mesh to use for this lens and height given the provided tolerances
+ * @brief A cache of the meshes that have been generated for a model and shape
  *
- * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
- * @tparam Shape  the type of shape to use when calculating the error
- *
- * @param meshes  the list of meshes that we will be looking for the target in
- * @param shape   the shape that we will be using for the lookup
- * @param h       the current height of the camera above the ground
- * @param k       the number of cross sectional intersections that we want with the object
- * @param t       the tolerance for the number of cross sectional intersections before we need a new mesh
- * @param d       the maximum distance that the mesh should be generated for
+ * @details
+ *  Meshes are grouped by the radius of the shape, the number of intersections and the maximum distance, and within
+ *  each group are ordered by height. As the error in the number of intersections only grows as the height of a mesh
+ *  moves away from the height we are at, only the meshes on either side of it need to be checked. When no mesh is close
+ *  enough a new one is generated without holding the lock, and any other thread that needs a mesh for a similar height
+ *  in the meantime waits for that one rather than generating its own.
  *
- * @return either returns a shared_ptr to the mesh that would best fit within our tolerance, or if none could be found a
- *         nullptr
+ * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam Model  the mesh model that the meshes are generated with
+ * @tparam Shape  the type of shape that the meshes are generated for
  */
 template <typename Scalar, template <typename> class Model, template <typename> class Shape>
-std::shared_ptr<visualmesh::Mesh<Scalar, Model>> find_mesh(
-  std::vector<std::shared_ptr<visualmesh::Mesh<Scalar, Model>>>& meshes,
-  const Shape<Scalar>& shape,
-  const Scalar& h,
-  const Scalar& k,
-  const Scalar& t,
-  const Scalar& d) {
-
-    // Nothing in the map!
-    if (meshes.empty()) { return nullptr; }
-
-    // Find the best mesh we have available
-    auto best_it      = meshes.begin();
-    Scalar best_error = std::numeric_limits<Scalar>::max();
-    for (auto it = meshes.begin(); it != meshes.end(); ++it) {
-        auto error = mesh_k_error(shape, (*it)->h, h, k);
-        if (d == (*it)->max_distance && error < best_error) {
-            best_error = error;
-            best_it    = it;
+class MeshCache {
+public:
+    /**
+     * @brief Lookup or create an appropriate Visual Mesh to use for this height given the provided tolerances
+     *
+     * @param shape                   the shape that we will be using for the lookup
+     * @param height                  the current height of the camera above the ground
+     * @param n_intersections         the number of cross sectional intersections that we want with the object
+     * @param intersection_tolerance  tolerance for the number of intersections before we need a new mesh
+     * @param cached_meshes           the number of meshes to cache at any one time before we delete one
+     * @param max_distance            the maximum distance that the mesh should be generated for
+     * @param cache_bytes             the most bytes the cached meshes can use before we delete one, or 0 for no limit
+     * @param concurrency             the number of threads to use when a new mesh needs to be generated
+     *
+     * @return the mesh to use for this height
+     */
+    std::shared_ptr<const visualmesh::Mesh<Scalar, Model>> get(const Shape<Scalar>& shape,
+                                                               const Scalar& height,
+                                                               const Scalar& n_intersections,
+                                                               const Scalar& intersection_tolerance,
+                                                               const int32_t& cached_meshes,
+                                                               const Scalar& max_distance,
+                                                               const int64_t& cache_bytes,
+                                                               const unsigned int& concurrency) {
+        std::unique_lock<std::mutex> lock(mutex);
+        Index& index = meshes[std::make_tuple(shape.r, n_intersections, max_distance)];
+
+        // Find the best mesh we have available, which is either the first one above or the last one below this height
+        auto best         = index.end();
+        Scalar best_error = std::numeric_limits<Scalar>::max();
+        const auto above  = index.lower_bound(height);
+        for (const auto& it : {above, above == index.begin() ? index.end() : std::prev(above)}) {
+            if (it != index.end()) {
+                const Scalar error = mesh_k_error(shape, it->first, height, n_intersections);
+                if (error < best_error) {
+                    best_error = error;
+                    best       = it;
+                }
+            }
         }
-    }
 
-    // If it was good enough return it, otherwise return null
-    if (best_error <= t) {
-        // Swap it to the top of the list so we can keep somewhat of which items are most used
-        std::iter_swap(meshes.begin(), best_it);
-        // iter_swap moves the lowest error mesh into the first position of meshes
-        return *meshes.begin();
+        // If it isn't good enough we will make a new one which other threads can wait for while it is generated
+        std::promise<std::shared_ptr<const visualmesh::Mesh<Scalar, Model>>> promise;
+        const bool build = best_error > intersection_tolerance;
+        if (build) { best = index.emplace(height, Entry{promise.get_future().share()}).first; }
+        best->second.last_used = ++clock;
+        const auto mesh        = best->second.mesh;
+        lock.unlock();
+
+        if (build) {
+            try {
+                // Generate the mesh using double precision and then cast it over to whatever we need
+                promise.set_value(std::make_shared<const visualmesh::Mesh<Scalar, Model>>(
+                  visualmesh::Mesh<double, Model>(shape, height, n_intersections, max_distance, "", concurrency)));
+            }
+            catch (...) {
+                // Forget the mesh so the next lookup tries again, and let anyone waiting for it know it failed
+                promise.set_exception(std::current_exception());
+                lock.lock();
+                index.erase(best);
+                throw;
+            }
+
+            // Now that we know how big it is, drop old meshes to make room for it
+            lock.lock();
+            best->second.bytes = mesh.get()->bytes();
+            bytes += best->second.bytes;
+            ++count;
+            evict(cached_meshes, cache_bytes, best->second);
+        }
+
+        // If another thread is still generating this mesh this will wait for it to finish
+        return mesh.get();
     }
-    else {
-        return nullptr;
+
+private:
+    /// A mesh in the cache
+    struct Entry {
+        /// The mesh, which will not be ready yet if it is still being generated
+        std::shared_future<std::shared_ptr<const visualmesh::Mesh<Scalar, Model>>> mesh;
+        /// The number of bytes the mesh uses, or 0 if it is still being generated
+        std::size_t bytes = 0;
+        /// When this mesh was last used, so the least recently used meshes can be dropped first
+        uint64_t last_used = 0;
+    };
+
+    /// The meshes for a radius, number of intersections and maximum distance by height
+    using Index = std::map<Scalar, Entry>;
+
+    /// Drop the least recently used meshes other than keep until they fit in the limits, holding the lock
+    void evict(const int32_t& cached_meshes, const int64_t& cache_bytes, const Entry& keep) {
+        while (count > cached_meshes || (cache_bytes > 0 && bytes > std::size_t(cache_bytes))) {
+            Index* oldest_index = nullptr;
+            typename Index::iterator oldest;
+            for (auto& index : meshes) {
+                for (auto it = index.second.begin(); it != index.second.end(); ++it) {
+                    if (it->second.bytes > 0 && &it->second != &keep
+                        && (oldest_index == nullptr || it->second.last_used < oldest->second.last_used)) {
+                        oldest_index = &index.second;
+                        oldest       = it;
+                    }
+                }
+            }
+            if (oldest_index == nullptr) { break; }
+
+            bytes -= oldest->second.bytes;
+            --count;
+            oldest_index->erase(oldest);
+        }
     }
-}
+
+    /// The meshes grouped by radius, number of intersections and maximum distance
+    std::map<std::tuple<Scalar, Scalar, Scalar>, Index> meshes;
+    /// Counts each time a mesh is used to track which was used least recently
+    uint64_t clock = 0;
+    /// The number of meshes that have been generated
+    int32_t count = 0;
+    /// The number of bytes used by the meshes that have been generated
+    std::size_t bytes = 0;
+    /// Protects the meshes as they are generated and dropped
+    std::mutex mutex;
+};
 
 /**
  * @brief Lookup or create an appropriate Visual Mesh to use for this lens and height given the provided tolerances
@@ -100,11 +193,13 @@ std::shared_ptr<visualmesh::Mesh<Scalar, Model>> find_mesh(
  * @details
  *  This function gets the best fitting mesh that it can find that is within the number of intersections tolerance. If
  *  it cannot find a mesh that matches the tolerance it will create a new one for the provided details. The mesh will
- *  not match if the maximum distance has changed, only if the k difference is small enough. Additionally it will only
- *  cache `cached_meshes` number of meshes. Each time a mesh is used again it will move it to the top of the list, and
- *  if a new mesh must be added and this would exceed this limit the least recently used mesh will be dropped.
+ *  only match if it was made for the same radius and maximum distance, and if the k difference is small enough.
+ *  Additionally it will only cache `cached_meshes` number of meshes using at most `cache_bytes` bytes. Each time a mesh
+ *  is used it is marked as recently used, and if a new mesh would exceed these limits the least recently used meshes
+ *  will be dropped. Meshes that are dropped stay alive for as long as an op is still using them.
  *
  * @tparam Scalar the scalar type used for calculations and storage (normally one of float or double)
+ * @tparam Model  the mesh model that the meshes are generated with
  * @tparam Shape  the type of shape to use when calculating the error
  *
  * @param shape                   the shape that we will be using for the lookup
@@ -113,53 +208,23 @@ std::shared_ptr<visualmesh::Mesh<Scalar, Model>> find_mesh(
  * @param intersection_tolerance  tolerance for the number of cross sectional intersections before we need a new mesh
  * @param cached_meshes           the number of meshes to cache at any one time before we delete one
  * @param max_distance            the maximum distance that the mesh should be generated for
+ * @param cache_bytes             the most bytes the cached meshes can use before we delete one, or 0 for no limit
  *
- * @return std::shared_ptr<visualmesh::Mesh<Scalar>>
+ * @return std::shared_ptr<const visualmesh::Mesh<Scalar, Model>>
  */
 template <typename Scalar, template <typename> class Model, template <typename> class Shape>
-std::shared_ptr<visualmesh::Mesh<Scalar, Model>> get_mesh(const Shape<Scalar>& shape,
-                                                          const Scalar& height,
-                                                          const Scalar& n_intersections,
-                                                          const Scalar& intersection_tolerance,
-                                                          const int32_t& cached_meshes,
-                                                          const Scalar& max_distance) {
-
-    // Static map of heights to meshes
-    static std::vector<std::shared_ptr<visualmesh::Mesh<Scalar, Model>>> meshes;
-    static std::mutex mesh_mutex;
-
-    // Find and return an element if one is appropriate
-    /* mutex scope */ {
-        std::lock_guard<std::mutex> lock(mesh_mutex);
-
-        // If we found an acceptable mesh return it
-        auto mesh = find_mesh(meshes, shape, height, n_intersections, intersection_tolerance, max_distance);
-        if (mesh != nullptr) { return mesh; }
-    }
-
-    // We can't find an appropriate mesh, make a new one but don't hold the mutex while we do so others can still query
-    // Generate the mesh using double precision and then cast it over to whatever we need
-    auto generated_mesh = visualmesh::Mesh<double, Model>(shape, height, n_intersections, max_distance);
-
-    /* mutex scope */ {
-        std::lock_guard<std::mutex> lock(mesh_mutex);
-
-        // Check again for an acceptable mesh in case someone else made one too
-        auto mesh = find_mesh(meshes, shape, height, n_intersections, intersection_tolerance, max_distance);
-        if (mesh != nullptr) { return mesh; }
-        // Otherwise add the one we made to the list
-        else {
-
-            // Only cache a fixed number of meshes so remove the old ones
-            while (static_cast<int32_t>(meshes.size()) > cached_meshes) {
-                meshes.pop_back();
-            }
-
-            // Add our new mesh to the cache and return
-            meshes.push_back(std::make_shared<visualmesh::Mesh<Scalar, Model>>(generated_mesh));
-            return meshes.back();
-        }
-    }
+std::shared_ptr<const visualmesh::Mesh<Scalar, Model>> get_mesh(const Shape<Scalar>& shape,
+                                                                const Scalar& height,
+                                                                const Scalar& n_intersections,
+                                                                const Scalar& intersection_tolerance,
+                                                                const int32_t& cached_meshes,
+                                                                const Scalar& max_distance,
+                                                                const int64_t& cache_bytes,
+                                                                const unsigned int& concurrency) {
+    // Every op that uses the same types shares one cache
+    static MeshCache<Scalar, Model, Shape> cache;
+    return cache.get(
+      shape, height, n_intersections, intersection_tolerance, cached_meshes, max_distance, cache_bytes, concurrency);
 }
 
 #endif  // VISUALMESH_TENSORFLOW_MESH_CACHE_HPP
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <tensorflow/core/framework/op.h>
+#include <tensorflow/core/framework/op_kernel.h>
+#include <tensorflow/core/framework/shape_inference.h>
+#include <tensorflow/core/util/work_sharder.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+enum Args {
+    IMAGE  = 0,
+    PIXELS = 1,
+};
+
+enum Outputs {
+    SAMPLES = 0,
+};
+
+REGISTER_OP("SampleVisualMesh")
+  .Attr("T: {float, double}")
+  .Attr("U: {uint8, float}")
+  .Input("image: U")
+  .Input("pixels: T")
+  .Output("samples: T")
+  .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(Outputs::SAMPLES, c->Matrix(c->Dim(c->input(Args::PIXELS), 0), c->Dim(c->input(Args::IMAGE), 2)));
+      return tensorflow::Status::OK();
+  });
+
+/**
+ * @brief The Visual Mesh image sampling op
+ *
+ * @details
+ *  This op samples the image at the pixel coordinates of each point in the visual mesh using bilinear interpolation,
+ *  which clamps the four pixels around each point to the edge of the image. A uint8 image is scaled to be between 0
+ *  and 1 in the same way as tf.image.convert_image_dtype, so it does not need to be converted to a float image first.
+ *  Points whose pixel coordinates are not finite, which the lookup can give for rays it could not project, are sampled
+ *  as zero.
+ *
+ * @tparam T The scalar type used for floating point numbers
+ * @tparam U The type of the values in the image
+ */
+template <typename T, typename U>
+class SampleVisualMeshOp : public tensorflow::OpKernel {
+public:
+    explicit SampleVisualMeshOp(tensorflow::OpKernelConstruction* context) : OpKernel(context) {}
+
+    /// Roughly how many cycles it takes to sample a single point for each channel of the image
+    static constexpr int64_t COST = 20;
+
+    void Compute(tensorflow::OpKernelContext* context) override {
+
+        // Check that the shape of each of the inputs is valid
+        OP_REQUIRES(context,
+                    context->input(Args::IMAGE).shape().dims() == 3,
+                    tensorflow::errors::InvalidArgument("The image must be a 3d tensor of [y, x, channels]"));
+        OP_REQUIRES(context,
+                    tensorflow::TensorShapeUtils::IsMatrix(context->input(Args::PIXELS).shape())
+                      && context->input(Args::PIXELS).shape().dim_size(1) == 2,
+                    tensorflow::errors::InvalidArgument("Pixels must be an nx2 matrix of [y, x] pixel coordinates"));
+
+        // Extract information from our input tensors
+        auto image            = context->input(Args::IMAGE).tensor<U, 3>();
+        auto pixels           = context->input(Args::PIXELS).matrix<T>();
+        const int64_t height  = context->input(Args::IMAGE).shape().dim_size(0);
+        const int64_t width   = context->input(Args::IMAGE).shape().dim_size(1);
+        const int64_t depth   = context->input(Args::IMAGE).shape().dim_size(2);
+        const int64_t n_elems = context->input(Args::PIXELS).shape().dim_size(0);
+
+        OP_REQUIRES(context,
+                    (height > 0 && width > 0) || n_elems == 0,
+                    tensorflow::errors::InvalidArgument("Cannot sample pixels from an empty image"));
+
+        // Create the output matrix to hold the samples
+        tensorflow::Tensor* samples = nullptr;
+        tensorflow::TensorShape samples_shape;
+        samples_shape.AddDim(n_elems);
+        samples_shape.AddDim(depth);
+        OP_REQUIRES_OK(context, context->allocate_output(Outputs::SAMPLES, samples_shape, &samples));
+
+        // Integer images are scaled so their largest value is 1
+        const T scale = std::is_integral<U>::value ? T(1) / T(std::numeric_limits<U>::max()) : T(1);
+
+        // Sample each of the points, splitting them over the intra op thread pool
+        auto s             = samples->matrix<T>();
+        const int64_t cost = COST * depth;
+        const auto workers = context->device()->tensorflow_cpu_worker_threads();
+        tensorflow::Shard(workers->num_threads, workers->workers, n_elems, cost, [&](int64_t start, int64_t end) {
+            for (int64_t i = start; i < end; ++i) {
+
+                // A point that did not project to a real pixel has nothing to sample
+                if (!std::isfinite(pixels(i, 0)) || !std::isfinite(pixels(i, 1))) {
+                    for (int64_t c = 0; c < depth; ++c) {
+                        s(i, c) = T(0);
+                    }
+                    continue;
+                }
+
+                // Clamp to one pixel past each edge, which samples the same as any point further out, so the
+                // coordinates always fit in an integer
+                const T py = std::min(std::max(pixels(i, 0), T(-1)), T(height));
+                const T px = std::min(std::max(pixels(i, 1), T(-1)), T(width));
+
+                // Get our four surrounding coordinates, making sure we clip to the edge of the screen
+                const T y         = std::floor(py);
+                const T x         = std::floor(px);
+                const T y_w       = py - y;
+                const T x_w       = px - x;
+                const int64_t y_0 = std::min(std::max(int64_t(y), int64_t(0)), height - 1);
+                const int64_t x_0 = std::min(std::max(int64_t(x), int64_t(0)), width - 1);
+                const int64_t y_1 = std::min(std::max(int64_t(y) + 1, int64_t(0)), height - 1);
+                const int64_t x_1 = std::min(std::max(int64_t(x) + 1, int64_t(0)), width - 1);
+
+                // Weight each of the pixel values based on their relative distance
+                for (int64_t c = 0; c < depth; ++c) {
+                    s(i, c) = (T(image(y_0, x_0, c)) * ((T(1) - y_w) * (T(1) - x_w))
+                               + T(image(y_0, x_1, c)) * ((T(1) - y_w) * x_w)
+                               + T(image(y_1, x_0, c)) * (y_w * (T(1) - x_w))
+                               + T(image(y_1, x_1, c)) * (y_w * x_w))
+                              * scale;
+                }
+            }
+        });
+    }
+};
+
+// Register a version for all the combinations of float/double and uint8/float
+REGISTER_KERNEL_BUILDER(Name("SampleVisualMesh")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<float>("T")
+                          .TypeConstraint<tensorflow::uint8>("U"),
+                        SampleVisualMeshOp<float, tensorflow::uint8>)
+REGISTER_KERNEL_BUILDER(Name("SampleVisualMesh")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<float>("T")
+                          .TypeConstraint<float>("U"),
+                        SampleVisualMeshOp<float, float>)
+REGISTER_KERNEL_BUILDER(Name("SampleVisualMesh")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<double>("T")
+                          .TypeConstraint<tensorflow::uint8>("U"),
+                        SampleVisualMeshOp<double, tensorflow::uint8>)
+REGISTER_KERNEL_BUILDER(Name("SampleVisualMesh")
+                          .Device(tensorflow::DEVICE_CPU)
+                          .TypeConstraint<double>("T")
+                          .TypeConstraint<float>("U"),
+                        SampleVisualMeshOp<double, float>)
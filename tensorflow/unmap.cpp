@@ -18,8 +18,10 @@
 #include <tensorflow/core/framework/op.h>
 #include <tensorflow/core/framework/op_kernel.h>
 #include <tensorflow/core/framework/shape_inference.h>
+#include <tensorflow/core/util/work_sharder.h>
 
 #include <cmath>
+#include <cstdint>
 #include <functional>
 
 #include "model_op_base.hpp"
@@ -65,6 +67,9 @@ public:
     explicit UnmapVisualMeshOp(tensorflow::OpKernelConstruction* context)
       : ModelOpBase<T, UnmapVisualMeshOp<T>, Args::MESH_MODEL, Args::GEOMETRY, Args::RADIUS>(context) {}
 
+    /// Roughly how many cycles it takes to unmap a single vector
+    static constexpr int64_t COST = 500;
+
     template <template <typename> class Model, typename Shape>
     void DoCompute(tensorflow::OpKernelContext* context, const Shape& shape) {
 
@@ -89,14 +94,17 @@ public:
         coordinates_shape.AddDim(2);
         OP_REQUIRES_OK(context, context->allocate_output(Outputs::COORDINATES, coordinates_shape, &coordinates));
 
-        // Perform the map operation for this shape
-        auto cs = coordinates->matrix<T>();
-        for (int i = 0; i < n_elems; ++i) {
-            visualmesh::vec2<T> c =
-              Model<T>::unmap(shape, height, visualmesh::vec3<T>({vectors(i, 0), vectors(i, 1), vectors(i, 2)}));
-            cs(i, 0) = c[0];
-            cs(i, 1) = c[1];
-        }
+        // Perform the unmap operation for this shape, splitting the vectors over the intra op thread pool
+        auto cs            = coordinates->matrix<T>();
+        const auto workers = context->device()->tensorflow_cpu_worker_threads();
+        tensorflow::Shard(workers->num_threads, workers->workers, n_elems, COST, [&](int64_t start, int64_t end) {
+            for (int64_t i = start; i < end; ++i) {
+                visualmesh::vec2<T> c =
+                  Model<T>::unmap(shape, height, visualmesh::vec3<T>({vectors(i, 0), vectors(i, 1), vectors(i, 2)}));
+                cs(i, 0) = c[0];
+                cs(i, 1) = c[1];
+            }
+        });
     }
 };
 
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017-2020 Trent Houliston <trent@houliston.me>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <thread>
+
+#include "visualmesh/geometry/Sphere.hpp"
+#include "visualmesh/model/ring6.hpp"
+#include "visualmesh/visualmesh.hpp"
+
+/**
+ * @brief Check that a visual mesh with a memory budget of a single byte only ever keeps the mesh it last returned
+ *
+ * @return true if the memory used stayed within the largest mesh for every lookup
+ */
+bool check(const visualmesh::MeshGeneration& generation, const char* name) {
+    visualmesh::VisualMesh<float, visualmesh::model::Ring6> mesh(
+      visualmesh::geometry::Sphere<float>(0.1f), 0.5f, 1.5f, 4, 0.2f, 10.0f, "", 1, generation, 1);
+
+    std::size_t largest = 0;
+    bool ok             = true;
+    const auto end      = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (std::chrono::steady_clock::now() < end) {
+        for (float h = 0.5f; h <= 1.5f; h += 0.05f) {
+            const auto m = mesh.get(h);
+            largest      = std::max(largest, m->bytes());
+            if (mesh.memory() > largest) {
+                std::cerr << name << ": " << mesh.memory() << " bytes used with a largest mesh of " << largest
+                          << std::endl;
+                ok = false;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return ok;
+}
+
+int main() {
+    const bool lazy       = check(visualmesh::LAZY, "LAZY");
+    const bool background = check(visualmesh::BACKGROUND, "BACKGROUND");
+    return lazy && background ? 0 : 1;
+}
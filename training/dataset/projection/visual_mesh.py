@@ -17,7 +17,6 @@ import re
 
 import tensorflow as tf
 from training.op import lookup_visual_mesh
-from training.projection import project
 
 
 class VisualMesh:
@@ -26,6 +25,7 @@ class VisualMesh:
         # Grab our relevant fields
         self.mesh_model = mesh["model"]
         self.cached_meshes = mesh["cached_meshes"]
+        self.cache_bytes = mesh.get("cache_bytes", 0)
         self.max_distance = mesh["max_distance"]
         self.geometry = tf.constant(geometry["shape"], dtype=tf.string, name="GeometryType")
         self.radius = geometry["radius"]
@@ -46,8 +46,8 @@ class VisualMesh:
 
     def __call__(self, image, Hoc, valid, **features):
 
-        # Lookup vectors in the visual mesh
-        V, G = lookup_visual_mesh(
+        # Lookup vectors in the visual mesh along with their pixel coordinates
+        V, G, C = lookup_visual_mesh(
             image_dimensions=tf.shape(image)[:2],
             lens_projection=features["lens/projection"],
             lens_focal_length=features["lens/focal_length"],
@@ -57,21 +57,13 @@ class VisualMesh:
             cam_to_observation_plane=Hoc,
             mesh_model=self.mesh_model,
             cached_meshes=self.cached_meshes,
+            cache_bytes=self.cache_bytes,
             max_distance=self.max_distance,
             geometry=self.geometry,
             radius=self.radius,
             n_intersections=self.n_intersections,
             intersection_tolerance=self.intersection_tolerance,
-        )
-
-        # Project them to pixel coordinates
-        C = project(
-            tf.einsum("ij,ki->kj", Hoc[:3, :3], V),
-            tf.shape(image)[:2],
-            features["lens/projection"],
-            features["lens/focal_length"],
-            features["lens/centre"],
-            features["lens/k"],
+            with_pixels=True,
         )
 
         # We actually do know the shape of G but tensorflow makes it a little hard to do in the c++ op
@@ -14,6 +14,7 @@
 # OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 import os
+import struct
 
 import numpy as np
 import yaml
@@ -26,6 +27,68 @@ from .layer.graph_convolution import GraphConvolution
 from .model import VisualMeshModel
 
 
+# The binary network file format, see cpp/visualmesh/network_file.hpp
+NETWORK_FILE_MAGIC = b"VMNN"
+NETWORK_FILE_VERSION = 1
+NETWORK_FILE_ORDER_MARK = 0x01020304
+NETWORK_FILE_ALIGNMENT = 64
+NETWORK_FILE_ACTIVATIONS = {"selu": 0, "relu": 1, "softmax": 2, "tanh": 3}
+
+
+def write_network_file(stages, path):
+    """Write the network as a binary network file that the C++ code can memory map"""
+
+    def align(offset):
+        return (offset + NETWORK_FILE_ALIGNMENT - 1) // NETWORK_FILE_ALIGNMENT * NETWORK_FILE_ALIGNMENT
+
+    scalar = np.dtype("<f4")
+    values_per_row = NETWORK_FILE_ALIGNMENT // scalar.itemsize
+    layers = [layer for stage in stages for layer in stage]
+
+    # Work out where each of the weights and biases will go
+    offset = 24 + 4 * len(stages) + 32 * len(layers)
+    headers = []
+    blobs = []
+    for layer in layers:
+        weights = np.asarray(layer["weights"], dtype=scalar)
+        biases = np.asarray(layer["biases"], dtype=scalar)
+        rows, cols = weights.shape
+        stride = (cols + values_per_row - 1) // values_per_row * values_per_row
+        weights = np.pad(weights, [[0, 0], [0, stride - cols]])
+
+        weights_offset = align(offset)
+        biases_offset = align(weights_offset + weights.nbytes)
+        offset = biases_offset + biases.nbytes
+
+        headers.append(
+            struct.pack(
+                "<IIIIQQ",
+                NETWORK_FILE_ACTIVATIONS[layer["activation"]],
+                rows,
+                cols,
+                stride,
+                weights_offset,
+                biases_offset,
+            )
+        )
+        blobs.append((weights_offset, weights))
+        blobs.append((biases_offset, biases))
+
+    with open(path, "wb") as out:
+        out.write(
+            NETWORK_FILE_MAGIC
+            + struct.pack(
+                "<IIIII", NETWORK_FILE_VERSION, NETWORK_FILE_ORDER_MARK, scalar.itemsize, len(stages), len(layers)
+            )
+        )
+        out.write(struct.pack("<{}I".format(len(stages)), *[len(stage) for stage in stages]))
+        for header in headers:
+            out.write(header)
+        for blob_offset, blob in blobs:
+            out.write(b"\0" * (blob_offset - out.tell()))
+            out.write(blob.tobytes())
+
+
 def export(config, output_path):
 
     # Get the training dataset so we know the output size
@@ -92,3 +155,5 @@ def export(config, output_path):
 
     with open(os.path.join(output_path, "model.yaml"), "w") as out:
         yaml.dump(stages, out, default_flow_style=None, width=float("inf"))
+
+    write_network_file(stages, os.path.join(output_path, "model.bin"))
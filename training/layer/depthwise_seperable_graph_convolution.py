@@ -15,6 +15,8 @@
 
 import tensorflow as tf
 
+from .gather import gather
+
 
 class Depthwise(tf.keras.layers.Layer):
     def __init__(self, **kwargs):
@@ -43,5 +45,5 @@ class DepthwiseSeparableGraphConvolution(tf.keras.layers.Layer):
         self.depthwise = Depthwise(**kwargs)
 
     def call(self, X, G):
-        convolved = tf.reshape(tf.gather(X, G, name="NetworkGather"), shape=[-1, G.shape[-1], X.shape[-1]])
+        convolved = tf.reshape(gather(X, G), shape=[-1, G.shape[-1], X.shape[-1]])
         return self.depthwise(convolved)
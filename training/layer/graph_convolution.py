@@ -15,6 +15,8 @@
 
 import tensorflow as tf
 
+from .gather import gather
+
 
 class GraphConvolution(tf.keras.layers.Layer):
     def __init__(self, **kwargs):
@@ -23,4 +25,4 @@ class GraphConvolution(tf.keras.layers.Layer):
 
     def call(self, X, G):
         # Call the dense layer with the gathered data
-        return self.dense(tf.reshape(tf.gather(X, G, name="NetworkGather"), shape=[-1, X.shape[-1] * G.shape[-1]]))
+        return self.dense(gather(X, G))
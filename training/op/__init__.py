@@ -16,6 +16,15 @@ else:
     raise Exception("Please build the tensorflow visual mesh op before running")
 
 lookup_visual_mesh = _library.lookup_visual_mesh
+lookup_visual_mesh_batch = _library.lookup_visual_mesh_batch
 map_visual_mesh = _library.map_visual_mesh
 unmap_visual_mesh = _library.unmap_visual_mesh
 difference_visual_mesh = _library.difference_visual_mesh
+sample_visual_mesh = _library.sample_visual_mesh
+gather_visual_mesh = _library.gather_visual_mesh
+
+
+@tf.RegisterGradient("GatherVisualMesh")
+def _gather_visual_mesh_grad(op, grad):
+    # The neighbours are indices so they have no gradient
+    return [_library.gather_visual_mesh_grad(grad, op.inputs[1], tf.shape(op.inputs[0])[0]), None]